@@ -0,0 +1,563 @@
+/**
+ * VroomLamp/bench/endpoint/LampEndpoint.cpp
+ *
+ * Simulated lamp on a pty, and a scripted client measuring the serial protocol's throughput.
+ *  --serve runs the unmodified firmware (setup()/loop() in src/main.cpp) in real time on the simulated
+ *  hardware, with its in-memory EEPROM and its serial port on a pty: the companion app or any client can
+ *  open the printed /dev/pts/N as it would a Nano. --baud paces the line like the real UART (10 bits per
+ *  byte, the firmware's receive ring and a 64 byte transmit buffer, 0 for instant transfers). Each boot
+ *  runs in a fresh child process, so a reset requested by the firmware starts it over from its initial
+ *  globals, with only the EEPROM (held in shared memory) kept.
+ *  --client uploads a test animation to all 6 slots, downloads them back and checks they match, reporting
+ *  time, bytes each way and round trips (turns of the line from client to lamp) per transfer. It works
+ *  against a real lamp too (e.g. /dev/ttyUSB0, with --boot 2000 to let the Nano come out of its reset).
+ *  With neither, both run: the endpoint in a child process, the client against it.
+ *
+ * Usage:
+ *  program [--baud n] [--frames n]
+ *  program --serve [--baud n] [--loop-us us] [--seconds n]
+ *  program --client /dev/pts/N [--baud n] [--frames n] [--boot ms]
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <AnimationDriver.h>
+#include <FrameCodec.h>
+#include <LampConfig.h>
+#include <LampSim.h>
+#include <UartSerial.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+// Defined by the firmware: restartLamp() by default (Health.softReset(), a marked restart from the reset vector)
+extern void (*resetFunc)(void);
+
+namespace
+{
+    double wallMs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+    }
+
+    // Raw mode at 115200 baud (the rate only matters on a real serial port)
+    void makeRaw(int fd)
+    {
+        termios tio;
+        if (tcgetattr(fd, &tio) == 0)
+        {
+            cfmakeraw(&tio);
+            cfsetspeed(&tio, B115200);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+    }
+
+    /************ ENDPOINT ***********/
+
+    // What outlives a boot: the EEPROM image, and the counters summed (or maxed) over the boots so far
+    struct persisted
+    {
+        uint8_t eeprom[E2END + 1];
+        unsigned long eepromWrites;
+        unsigned long rxLost;
+        uint8_t rxHighWater;
+        uint8_t rxSize;
+    };
+
+    // Exit status of a boot that ended in a reset requested by the firmware
+    const int RESET_EXIT = 3;
+
+    persisted *kept = 0;
+    volatile sig_atomic_t stopping = 0;
+    volatile pid_t booted = 0;
+
+    void stop(int)
+    {
+        stopping = 1;
+        if (booted > 0)
+        {
+            kill(booted, SIGTERM);
+        }
+    }
+
+    void keep()
+    {
+        memcpy(kept->eeprom, EEPROM.data, sizeof(kept->eeprom));
+        kept->eepromWrites += EEPROM.writes;
+        kept->rxLost += Uart.rxLost();
+        kept->rxSize = Uart.rxSize();
+        if (Uart.rxHighWater() > kept->rxHighWater)
+        {
+            kept->rxHighWater = Uart.rxHighWater();
+        }
+    }
+
+    void simulatedReset()
+    {
+        keep();
+        _exit(RESET_EXIT);
+    }
+
+    // One boot, in its own process so every global starts out as on a freshly powered board
+    void boot(int fd, unsigned long baud, unsigned long loopUs, double seconds, double start)
+    {
+        memcpy(EEPROM.data, kept->eeprom, sizeof(kept->eeprom));
+        LampSim::serialAttach(fd, fd);
+        // The firmware's receive ring, as the UART driver sizes it
+        LampSim::serialPace(baud, SERIAL_RX_SIZE - 1);
+        // Stick at rest in gear 1 with the knob at full brightness
+        LampSim::setAnalog(POT_PIN, 1023);
+        LampSim::setAnalog(STICK_PIN_1, G1_1);
+        LampSim::setAnalog(STICK_PIN_2, G1_2);
+        LampSim::setRealTime(true);
+        resetFunc = simulatedReset;
+
+        setup();
+        while (!stopping && (seconds <= 0 || wallMs() - start < seconds * 1000))
+        {
+            loop();
+            LampSim::advanceMicros(loopUs);
+        }
+        keep();
+        _exit(0);
+    }
+
+    // Runs the firmware on a pty until stopped (or for a time), prints the client's end first
+    int serve(unsigned long baud, unsigned long loopUs, double seconds)
+    {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) || unlockpt(fd))
+        {
+            perror("pty");
+            return 1;
+        }
+        // Hold the client's end open in raw mode, so output sent before a client attaches is not mangled
+        int peer = open(ptsname(fd), O_RDWR | O_NOCTTY);
+        makeRaw(peer);
+        printf("pty: %s\n", ptsname(fd));
+        fflush(stdout);
+
+        // Shared with the boots, which write it back as they end
+        void *shared = mmap(0, sizeof(persisted), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared == MAP_FAILED)
+        {
+            perror("mmap");
+            return 1;
+        }
+        kept = (persisted *)shared;
+        memcpy(kept->eeprom, EEPROM.data, sizeof(kept->eeprom));
+        signal(SIGTERM, stop);
+        signal(SIGINT, stop);
+
+        // Held off while forking, so a stop always reaches the boot running
+        sigset_t stops, was;
+        sigemptyset(&stops);
+        sigaddset(&stops, SIGTERM);
+        sigaddset(&stops, SIGINT);
+
+        unsigned long resets = 0;
+        double start = wallMs();
+        while (!stopping)
+        {
+            sigprocmask(SIG_BLOCK, &stops, &was);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                booted = 0;
+                sigprocmask(SIG_SETMASK, &was, 0);
+                boot(fd, baud, loopUs, seconds, start);
+            }
+            booted = pid;
+            sigprocmask(SIG_SETMASK, &was, 0);
+            if (pid < 0)
+            {
+                perror("fork");
+                break;
+            }
+            int status = 0;
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            {
+            }
+            booted = 0;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != RESET_EXIT)
+            {
+                break;
+            }
+            resets++;
+        }
+        fprintf(stderr, "endpoint: %lu resets, %lu EEPROM bytes written, receive ring high water %u of %u, %lu bytes lost\n",
+                resets, kept->eepromWrites, kept->rxHighWater, kept->rxSize, kept->rxLost);
+        munmap(shared, sizeof(persisted));
+        close(peer);
+        close(fd);
+        return 0;
+    }
+
+    /************ CLIENT ***********/
+
+    struct link
+    {
+        int fd;
+        unsigned long sent;
+        unsigned long received;
+        unsigned long roundTrips;
+        bool turn; // Sent since the last receive, the next byte in completes a round trip
+    };
+
+    struct transfer
+    {
+        double ms;
+        unsigned long sent;
+        unsigned long received;
+        unsigned long roundTrips;
+    };
+
+    const int TIMEOUT_MS = 3000;
+
+    bool sendBytes(link &l, const uint8_t *buff, size_t len)
+    {
+        size_t n = 0;
+        while (n < len)
+        {
+            ssize_t w = write(l.fd, buff + n, len - n);
+            if (w <= 0)
+            {
+                return false;
+            }
+            n += w;
+        }
+        l.sent += len;
+        l.turn = true;
+        return true;
+    }
+
+    bool sendString(link &l, const char *s) { return sendBytes(l, (const uint8_t *)s, strlen(s)); }
+
+    bool sendAck(link &l)
+    {
+        uint8_t ack = 0xFF;
+        return sendBytes(l, &ack, 1);
+    }
+
+    bool receive(link &l, uint8_t *buff, size_t len)
+    {
+        size_t n = 0;
+        while (n < len)
+        {
+            pollfd p = {l.fd, POLLIN, 0};
+            if (poll(&p, 1, TIMEOUT_MS) <= 0)
+            {
+                return false;
+            }
+            ssize_t r = read(l.fd, buff + n, len - n);
+            if (r <= 0)
+            {
+                return false;
+            }
+            n += r;
+            l.received += r;
+            if (l.turn)
+            {
+                l.roundTrips++;
+                l.turn = false;
+            }
+        }
+        return true;
+    }
+
+    bool receiveLine(link &l, std::string &line)
+    {
+        line.clear();
+        uint8_t c;
+        while (receive(l, &c, 1))
+        {
+            if (c == '\n')
+            {
+                if (!line.empty() && line[line.size() - 1] == '\r')
+                {
+                    line.erase(line.size() - 1);
+                }
+                return true;
+            }
+            line += (char)c;
+        }
+        return false;
+    }
+
+    // Sends a request code and waits for its echo, skipping anything else (e.g. the banner after a reset)
+    bool request(link &l, const char *code)
+    {
+        std::string expected = std::string("ready_") + code;
+        std::string line;
+        if (!sendString(l, code) || !sendString(l, "-"))
+        {
+            return false;
+        }
+        while (receiveLine(l, line))
+        {
+            if (line == expected)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool expectLine(link &l, const char *expected)
+    {
+        std::string line;
+        while (receiveLine(l, line))
+        {
+            if (line == expected)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Test animation for a slot: a ramp through distinct colors, frames 100 ms apart
+    AnimationDriver::animation testAnimation(uint8_t slot, uint8_t frames)
+    {
+        AnimationDriver::animation anim = {};
+        for (uint8_t i = 0; i < frames; i++)
+        {
+            anim.frames[i].color[0] = slot * 40 + i;
+            anim.frames[i].color[1] = 255 - i * 12;
+            anim.frames[i].color[2] = i * 7 + slot;
+            anim.frames[i].time = AnimationDriver::easedTime(i * 100UL, (AnimationDriver::easing)(i % 8));
+        }
+        anim.frameCount = frames;
+        anim.time = (frames - 1) * 100UL;
+        return anim;
+    }
+
+    // Upload: code, payload echoed back, acknowledge, "Done"
+    bool upload(link &l, uint8_t slot, const AnimationDriver::animation &anim)
+    {
+        char code[2] = {(char)('0' + slot), 0};
+        std::vector<uint8_t> payload(2 + FRAME_COUNT(anim.frameCount) * FRAME_SIZE);
+        payload[0] = slot;
+        payload[1] = anim.frameCount;
+        encodeFrames(anim, &payload[2]);
+        std::vector<uint8_t> echo(payload.size());
+        if (!request(l, code) || !sendBytes(l, payload.data(), payload.size()) || !receive(l, echo.data(), echo.size()))
+        {
+            return false;
+        }
+        if (echo != payload)
+        {
+            fprintf(stderr, "slot %u: echo does not match\n", slot);
+            return false;
+        }
+        return sendAck(l) && expectLine(l, "Done");
+    }
+
+    // Download: per slot, acknowledge -> slot and frame count, acknowledge -> frames, acknowledge
+    bool download(link &l, std::vector<std::vector<uint8_t> > &slots, std::vector<transfer> &perSlot)
+    {
+        if (!request(l, "d"))
+        {
+            return false;
+        }
+        for (uint8_t i = 0; i < GEAR_COUNT; i++)
+        {
+            link before = l;
+            double start = wallMs();
+            uint8_t header[2];
+            if (!sendAck(l) || !receive(l, header, 2))
+            {
+                return false;
+            }
+            std::vector<uint8_t> frames(FRAME_COUNT(header[1]) * FRAME_SIZE);
+            if (!sendAck(l) || (frames.size() && !receive(l, frames.data(), frames.size())) || !sendAck(l))
+            {
+                return false;
+            }
+            frames.insert(frames.begin(), header, header + 2);
+            slots.push_back(frames);
+            transfer t = {wallMs() - start, l.sent - before.sent, l.received - before.received, l.roundTrips - before.roundTrips};
+            perSlot.push_back(t);
+        }
+        return true;
+    }
+
+    void printTransfer(const char *name, const transfer &t, unsigned long payload, unsigned long baud)
+    {
+        printf("%-10s %9.1f %7lu %9lu %7lu", name, t.ms, t.sent, t.received, t.roundTrips);
+        if (baud)
+        {
+            // Time the bytes alone take on the line, each direction in turn
+            printf(" %8.1f", (t.sent + t.received) * 10000.0 / baud);
+        }
+        printf(" %8.0f\n", payload * 1000.0 / t.ms);
+    }
+
+    int client(const char *path, unsigned long baud, uint8_t frames, int bootMs)
+    {
+        int fd = open(path, O_RDWR | O_NOCTTY);
+        if (fd < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        makeRaw(fd);
+        if (bootMs > 0)
+        {
+            usleep(bootMs * 1000);
+        }
+        // Start from a quiet line
+        tcflush(fd, TCIFLUSH);
+        link l = {fd, 0, 0, 0, false};
+        unsigned long payload = 2 + (unsigned long)frames * FRAME_SIZE;
+
+        printf("%u frames per slot (%lu byte payload)%s\n", frames, payload, baud ? "" : ", line not paced");
+        printf("%-10s %9s %7s %9s %7s%s %8s\n", "transfer", "ms", "sent", "received", "trips", baud ? " wire-ms" : "", "B/s");
+
+        std::vector<AnimationDriver::animation> anims;
+        transfer total = {0, 0, 0, 0};
+        for (uint8_t i = 0; i < GEAR_COUNT; i++)
+        {
+            anims.push_back(testAnimation(i, frames));
+            link before = l;
+            double start = wallMs();
+            if (!upload(l, i, anims[i]))
+            {
+                fprintf(stderr, "upload to slot %u failed\n", i);
+                return 1;
+            }
+            transfer t = {wallMs() - start, l.sent - before.sent, l.received - before.received, l.roundTrips - before.roundTrips};
+            char name[16];
+            snprintf(name, sizeof(name), "upload %u", i);
+            printTransfer(name, t, payload, baud);
+            total.ms += t.ms;
+            total.sent += t.sent;
+            total.received += t.received;
+            total.roundTrips += t.roundTrips;
+        }
+        printTransfer("upload", total, payload * GEAR_COUNT, baud);
+
+        std::vector<std::vector<uint8_t> > slots;
+        std::vector<transfer> perSlot;
+        link before = l;
+        double start = wallMs();
+        if (!download(l, slots, perSlot))
+        {
+            fprintf(stderr, "download failed after %lu slots\n", (unsigned long)slots.size());
+            return 1;
+        }
+        transfer all = {wallMs() - start, l.sent - before.sent, l.received - before.received, l.roundTrips - before.roundTrips};
+        for (uint8_t i = 0; i < GEAR_COUNT; i++)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "download %u", i);
+            printTransfer(name, perSlot[i], payload, baud);
+        }
+        printTransfer("download", all, payload * GEAR_COUNT, baud);
+
+        // Each gear now plays the slot uploaded to it
+        int mismatches = 0;
+        for (uint8_t i = 0; i < GEAR_COUNT; i++)
+        {
+            std::vector<uint8_t> expected(2 + FRAME_COUNT(anims[i].frameCount) * FRAME_SIZE);
+            expected[0] = i;
+            expected[1] = anims[i].frameCount;
+            encodeFrames(anims[i], &expected[2]);
+            if (slots[i] != expected)
+            {
+                fprintf(stderr, "slot %u: downloaded animation does not match the upload\n", i);
+                mismatches++;
+            }
+        }
+        close(fd);
+        return mismatches ? 1 : 0;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool serveOnly = false;
+    const char *clientPath = 0;
+    unsigned long baud = 115200, loopUs = 300;
+    double seconds = 0;
+    int frames = 20, bootMs = 0;
+    bool usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--serve"))
+            serveOnly = true;
+        else if (!strcmp(argv[i], "--client") && i + 1 < argc)
+            clientPath = argv[++i];
+        else if (!strcmp(argv[i], "--baud") && i + 1 < argc)
+            baud = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--loop-us") && i + 1 < argc)
+            loopUs = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--boot") && i + 1 < argc)
+            bootMs = atoi(argv[++i]);
+        else
+            usage = true;
+    }
+    if (usage || (serveOnly && clientPath) || frames < 1 || frames > 20)
+    {
+        fprintf(stderr, "usage: %s [--baud n] [--frames 1-20]\n"
+                        "       %s --serve [--baud n] [--loop-us us] [--seconds n]\n"
+                        "       %s --client /dev/pts/N [--baud n] [--frames 1-20] [--boot ms]\n",
+                argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (serveOnly)
+    {
+        return serve(baud, loopUs, seconds);
+    }
+    if (clientPath)
+    {
+        return client(clientPath, baud, frames, bootMs);
+    }
+
+    // Both: the endpoint in a child, its pty path read back from its output
+    int pipeFds[2];
+    if (pipe(pipeFds))
+    {
+        perror("pipe");
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0)
+    {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        return serve(baud, loopUs, 0);
+    }
+    close(pipeFds[1]);
+    FILE *out = fdopen(pipeFds[0], "r");
+    char pty[64];
+    int status = 1;
+    if (out && fscanf(out, "pty: %63s", pty) == 1)
+    {
+        status = client(pty, baud, frames, 0);
+    }
+    else
+    {
+        fprintf(stderr, "endpoint did not start\n");
+    }
+    kill(child, SIGTERM);
+    waitpid(child, 0, 0);
+    return status;
+}
@@ -0,0 +1,513 @@
+/**
+ * VroomLamp/bench/kernels/KernelBench.cpp
+ *
+ * Microbenchmarks for the firmware's hot kernels in isolation: animation rendering (keyframes, easings,
+ *  scripts), the stick sensor filter and gear lookup, the shifter FSM in each state, and the serial
+ *  frame codec used by uploads and downloads.
+ *  - Native: ns per call. Host timings only rank alternatives, AVR costs differ (float math is far more
+ *    expensive there). Each kernel is warmed up, then timed over several runs each sized to take about
+ *    RUN_MS (or --iterations calls), taken in turn with the other kernels; the median is reported with the
+ *    fastest and slowest runs, so a noisy machine shows as a wide spread. --csv prints "kernel,ns,min,max" rows for
+ *    diffing between commits.
+ *  - On target (env nano_kernels): CPU cycles per call counted with Timer1, printed over serial at boot.
+ *    The millis() tick is masked while a kernel runs, so counts are exact to the cycle between runs (the
+ *    fastest of BENCH_RUNS is reported).
+ *
+ * Usage: program [--iterations n] [--runs n] [--csv] [filter]
+ */
+#include <Arduino.h>
+#include <AnimationDriver.h>
+#include <DefaultAnimations.h>
+#include <ScriptVM.h>
+#include <ShifterFSM.h>
+#include <StickSensor.h>
+#include <FrameCodec.h>
+#include <LampConfig.h>
+#include <UartSerial.h>
+
+#include <stdio.h>
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#else
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#endif
+
+namespace
+{
+    GENERATED_ANIMATION(Rainbow_RGB, AnimationDriver::Rainbow<4000UL>);
+    GENERATED_ANIMATION(Rainbow_HSV, AnimationDriver::HueSweep<4000UL>);
+
+    volatile uint8_t sink; // Keeps results alive
+
+    // Time step between ticks, roughly one loop() pass
+    const unsigned long TICK_MS = 3;
+
+    // The original float RGB path: a full animation copy, one frame advance per tick, float blend
+    struct legacyDriver
+    {
+        AnimationDriver::animation anim;
+        unsigned long currentTime, lastStartTime;
+        uint8_t frameIndex;
+        uint8_t color[3];
+
+        // Called out of line, as the firmware called it from another file (and as render() is called)
+        __attribute__((noinline)) void run(unsigned long now)
+        {
+            currentTime = now - lastStartTime;
+            if (currentTime > anim.frames[frameIndex + 1].time)
+            {
+                frameIndex++;
+                if (frameIndex == anim.frameCount - 1)
+                {
+                    lastStartTime += anim.time;
+                    currentTime -= anim.time;
+                    frameIndex = 0;
+                }
+            }
+            AnimationDriver::animFrame *last = &anim.frames[frameIndex];
+            AnimationDriver::animFrame *next = &anim.frames[frameIndex + 1];
+            for (uint8_t i = 0; i < 3; i++)
+            {
+                color[i] = (uint8_t)((float)last->color[i] + ((float)next->color[i] - (float)last->color[i]) / ((float)next->time - (float)last->time) * (float)(currentTime - last->time));
+            }
+        }
+    };
+
+    // Expands a flash animation (header and frames in PROGMEM) into a full animation struct
+    void expand(const AnimationDriver::flashAnimation *src, AnimationDriver::animation &dst)
+    {
+        AnimationDriver::flashAnimation header;
+        memcpy_P(&header, src, sizeof(header));
+        memcpy_P(dst.frames, header.frames, FRAME_COUNT(header.frameCount) * sizeof(AnimationDriver::animFrame));
+        dst.frameCount = header.frameCount;
+        dst.time = header.time;
+    }
+
+    void benchLegacyRgb(unsigned long iterations)
+    {
+        legacyDriver d = {};
+        expand(&Rainbow_RGB, d.anim);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            d.run(i * TICK_MS);
+            sink = d.color[0] ^ d.color[1] ^ d.color[2];
+        }
+    }
+
+    void benchCore(const AnimationDriver::flashAnimation *anim, unsigned long iterations)
+    {
+        AnimationDriver::AnimationCore core;
+        core.updateAnimationP(anim, 0);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            const uint8_t *c = core.render(i * TICK_MS);
+            sink = c[0] ^ c[1] ^ c[2];
+        }
+    }
+
+    void benchCoreRgb(unsigned long iterations) { benchCore(&Rainbow_RGB, iterations); }
+    void benchCoreHsv(unsigned long iterations) { benchCore(&Rainbow_HSV, iterations); }
+
+    // Sparkle: random pixels in random hues, fading out
+    const uint8_t sparkle[] = {
+        AnimationDriver::OP_RMASK,
+        AnimationDriver::OP_RHUE, 255, 255,
+        AnimationDriver::OP_FADE, 0, 0, 0, 0, 120,
+        AnimationDriver::OP_RWAIT, 0, 80,
+    };
+    // Chase: one pixel stepping round, changing hue every lap
+    const uint8_t chase[] = {
+        AnimationDriver::OP_MASK, 0x01,
+        AnimationDriver::OP_RFADE, 255, 255, 0, 50,
+        AnimationDriver::OP_LOOP, 3,
+        AnimationDriver::OP_WAIT, 0, 80,
+        AnimationDriver::OP_ROTATE,
+        AnimationDriver::OP_NEXT,
+    };
+
+    void benchScript(const uint8_t *program, uint8_t length, unsigned long iterations)
+    {
+        AnimationDriver::ScriptCore vm(4);
+        vm.load(program, length, 0);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            const uint8_t *c = vm.render(i * TICK_MS);
+            sink = c[0] ^ c[1] ^ c[2] ^ vm.getMask();
+        }
+    }
+
+    void benchScriptKeyframes(unsigned long iterations)
+    {
+        AnimationDriver::animation anim;
+        expand(&Rainbow_RGB, anim);
+        uint8_t program[140];
+        benchScript(program, AnimationDriver::compileKeyframes(anim, program, sizeof(program)), iterations);
+    }
+    void benchScriptSparkle(unsigned long iterations) { benchScript(sparkle, sizeof(sparkle), iterations); }
+    void benchScriptChase(unsigned long iterations) { benchScript(chase, sizeof(chase), iterations); }
+
+    void benchHsvToRgb(unsigned long iterations)
+    {
+        uint8_t rgb[3];
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            AnimationDriver::hsvToRgb((uint16_t)(i * 97), 255, 255, rgb);
+            sink = rgb[0] ^ rgb[1] ^ rgb[2];
+        }
+    }
+
+    // Clock policy for the driver templates, set by the kernel before each call
+    struct benchClock
+    {
+        static unsigned long time;
+        static unsigned long now() { return time; }
+    };
+    unsigned long benchClock::time = 0;
+
+    // Animation with evenly spaced frames over 4 s, alternating colors on every channel
+    AnimationDriver::animation rampAnim;
+    void ramp(uint8_t frames)
+    {
+        for (uint8_t i = 0; i < frames; i++)
+        {
+            rampAnim.frames[i].color[0] = i & 1 ? 255 : 0;
+            rampAnim.frames[i].color[1] = i & 1 ? 0 : 200;
+            rampAnim.frames[i].color[2] = i * 12;
+            rampAnim.frames[i].time = 4000UL * i / (frames - 1);
+        }
+        rampAnim.frameCount = frames;
+        rampAnim.time = 4000;
+    }
+
+    // AnimationDriverT::run() as called from loop(), for an SRAM animation of a given frame count
+    template <uint8_t Frames>
+    void benchRun(unsigned long iterations)
+    {
+        ramp(Frames);
+        benchClock::time = 0;
+        AnimationDriver::AnimationDriverT<benchClock> driver;
+        driver.updateAnimation(rampAnim);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            benchClock::time = i * TICK_MS;
+            driver.run([](uint8_t r, uint8_t g, uint8_t b)
+                       { sink = r ^ g ^ b; });
+        }
+    }
+
+    // Color interpolation for one easing (a single 4 s segment, so no frame loads)
+    template <AnimationDriver::easing Ease>
+    void benchEase(unsigned long iterations)
+    {
+        ramp(2);
+        rampAnim.frames[0].time = AnimationDriver::easedTime(0, Ease);
+        AnimationDriver::AnimationCore core;
+        core.updateAnimation(rampAnim, 0);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            const uint8_t *c = core.render(i * TICK_MS % 4000);
+            sink = c[0] ^ c[1] ^ c[2];
+        }
+    }
+
+    // Filtered readings at each gear, then one between gears (neutral, every check fails)
+    const int stickReadings[8][2] = {{GR_1, GR_2}, {G1_1, G1_2}, {G2_1, G2_2}, {G3_1, G3_2},
+                                     {G4_1, G4_2}, {G5_1, G5_2}, {G6_1, G6_2}, {200, 250}};
+
+    void benchStickPos(unsigned long iterations)
+    {
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            const int *r = stickReadings[i & 7];
+            sink = getStickPos(r[0], r[1]);
+        }
+    }
+
+    void benchStickPosNeutral(unsigned long iterations)
+    {
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            sink = getStickPos(stickReadings[7][0], stickReadings[7][1]);
+        }
+    }
+
+    void benchStickFilter(unsigned long iterations)
+    {
+        StickFilter filter(STICK_PIN_1);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            sink = filter.update((i * 37) & 1023);
+        }
+    }
+
+    // Shifter FSM held in one state
+    void benchShifterPolling(unsigned long iterations)
+    {
+        ShifterFSMCore fsm(T_SETTLE);
+        fsm.init(1);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            sink = fsm.run(1, false, i);
+        }
+    }
+
+    void benchShifterMoving(unsigned long iterations)
+    {
+        ShifterFSMCore fsm(T_SETTLE);
+        fsm.init(1);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            sink = fsm.run(1, true, i);
+        }
+    }
+
+    void benchShifterArmed(unsigned long iterations)
+    {
+        // Never settles
+        ShifterFSMCore fsm(0xFFFFFFFFUL);
+        fsm.init(1);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            sink = fsm.run(2, false, i);
+        }
+    }
+
+    // Stick policy for the shifter template: the bench clock, settled gears kept alive
+    struct benchStick : benchClock
+    {
+        static void settled(ShifterFSMCore::mode gear) { sink = gear; }
+    };
+
+    // A full shift every 4 passes: polling sees a new gear, armed settles, update (reported), polling again
+    void benchShifterShift(unsigned long iterations)
+    {
+        ShifterFSMT<benchStick> fsm(0);
+        fsm.init(1);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            benchClock::time = i;
+            sink = fsm.run(i & 4 ? 2 : 1, false);
+        }
+    }
+
+    // Upload and download frame codec, for a full 20 frame animation
+    uint8_t frameBuff[20 * FRAME_SIZE];
+
+    void benchDecode(unsigned long iterations)
+    {
+        ramp(20);
+        encodeFrames(rampAnim, frameBuff);
+        AnimationDriver::animation anim;
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            frameBuff[0] = i;
+            decodeAnimation(20, frameBuff, anim);
+            sink = anim.frames[0].color[0];
+        }
+    }
+
+    void benchEncode(unsigned long iterations)
+    {
+        ramp(20);
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            rampAnim.frames[0].color[0] = i;
+            sink = encodeFrames(rampAnim, frameBuff) ^ frameBuff[0];
+        }
+    }
+
+    struct kernel
+    {
+        const char *name;
+        void (*run)(unsigned long iterations);
+    };
+
+    const kernel kernels[] = {
+        {"render/rainbow13/float-rgb (original)", benchLegacyRgb},
+        {"render/rainbow13/int-rgb", benchCoreRgb},
+        {"render/rainbow2/int-hsv", benchCoreHsv},
+        {"script/rainbow13 (compiled keyframes)", benchScriptKeyframes},
+        {"script/sparkle", benchScriptSparkle},
+        {"script/chase", benchScriptChase},
+        {"hsvToRgb", benchHsvToRgb},
+        {"run/keyframes2", benchRun<2>},
+        {"run/keyframes5", benchRun<5>},
+        {"run/keyframes10", benchRun<10>},
+        {"run/keyframes20", benchRun<20>},
+        {"interpolate/linear", benchEase<AnimationDriver::LINEAR>},
+        {"interpolate/step", benchEase<AnimationDriver::STEP>},
+        {"interpolate/ease-in", benchEase<AnimationDriver::EASE_IN>},
+        {"interpolate/ease-out", benchEase<AnimationDriver::EASE_OUT>},
+        {"interpolate/ease-in-out", benchEase<AnimationDriver::EASE_IN_OUT>},
+        {"interpolate/sine", benchEase<AnimationDriver::SINE>},
+        {"interpolate/cubic-in", benchEase<AnimationDriver::CUBIC_IN>},
+        {"interpolate/cubic-out", benchEase<AnimationDriver::CUBIC_OUT>},
+        {"sticks/getStickPos", benchStickPos},
+        {"sticks/getStickPos-neutral", benchStickPosNeutral},
+        {"sticks/filter", benchStickFilter},
+        {"shifter/polling", benchShifterPolling},
+        {"shifter/moving", benchShifterMoving},
+        {"shifter/armed", benchShifterArmed},
+        {"shifter/shift", benchShifterShift},
+        {"serial/decode20", benchDecode},
+        {"serial/encode20", benchEncode},
+    };
+    const unsigned int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+} // namespace
+
+#ifdef __AVR__
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 1000
+#endif
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 3
+#endif
+
+volatile uint16_t overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+    overflows++;
+}
+
+// CPU cycles taken by one run of a kernel
+uint32_t countCycles(const kernel &k)
+{
+    Uart.flush();
+    uint8_t timer0 = TIMSK0;
+    TIMSK0 = 0;
+    overflows = 0;
+    TCNT1 = 0;
+    TCCR1B = _BV(CS10);
+    k.run(BENCH_ITERATIONS);
+    TCCR1B = 0;
+    uint32_t cycles;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (TIFR1 & _BV(TOV1))
+        {
+            // Overflowed as the timer stopped
+            overflows++;
+            TIFR1 = _BV(TOV1);
+        }
+        cycles = (uint32_t)overflows << 16 | TCNT1;
+    }
+    TIMSK0 = timer0;
+    return cycles;
+}
+
+void setup()
+{
+    Uart.begin(115200);
+    // Timer1 counts CPU cycles
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TIMSK1 = _BV(TOIE1);
+    Uart.print(F("iterations: "));
+    Uart.println(BENCH_ITERATIONS);
+    for (unsigned int k = 0; k < kernelCount; k++)
+    {
+        uint32_t best = 0;
+        for (unsigned int r = 0; r < BENCH_RUNS; r++)
+        {
+            uint32_t cycles = countCycles(kernels[k]);
+            if (r == 0 || cycles < best)
+            {
+                best = cycles;
+            }
+        }
+        Uart.print(kernels[k].name);
+        Uart.print(F(","));
+        Uart.println((float)best / BENCH_ITERATIONS, 1);
+    }
+    Uart.println(F("done"));
+}
+
+void loop() {}
+#else
+// Length of a timed run on the host when --iterations is not given
+const double RUN_MS = 20;
+
+// ns per call over one run of a kernel
+double timeRun(const kernel &k, unsigned long iterations)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    k.run(iterations);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = 0;
+    unsigned int runs = 11;
+    bool csv = false;
+    const char *filter = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+            iterations = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--csv"))
+            csv = true;
+        else if (argv[i][0] != '-')
+            filter = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--iterations n] [--runs n] [--csv] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1)
+    {
+        runs = 1;
+    }
+    if (csv)
+    {
+        printf("kernel,ns,min,max\n");
+    }
+
+    // Warm up each kernel (caches, branch predictors, clock speed), sizing its runs on the way unless told how long
+    std::vector<const kernel *> selected;
+    std::vector<unsigned long> sizes;
+    for (unsigned int k = 0; k < kernelCount; k++)
+    {
+        if (filter && !strstr(kernels[k].name, filter))
+        {
+            continue;
+        }
+        unsigned long n = iterations ? iterations : 1000;
+        double ns = timeRun(kernels[k], n);
+        while (!iterations && ns * n < RUN_MS * 1e6 / 4 && n < 0x10000000UL)
+        {
+            n *= 4;
+            ns = timeRun(kernels[k], n);
+        }
+        selected.push_back(&kernels[k]);
+        sizes.push_back(iterations ? n : (unsigned long)(RUN_MS * 1e6 / ns) + 1);
+    }
+    // Runs go round the kernels, so a slow spell of the machine lands on all of them rather than a few
+    std::vector<std::vector<double> > times(selected.size());
+    for (unsigned int r = 0; r < runs; r++)
+    {
+        for (size_t k = 0; k < selected.size(); k++)
+        {
+            times[k].push_back(timeRun(*selected[k], sizes[k]));
+        }
+    }
+    for (size_t k = 0; k < selected.size(); k++)
+    {
+        std::vector<double> &t = times[k];
+        std::sort(t.begin(), t.end());
+        double median = runs & 1 ? t[runs / 2] : (t[runs / 2 - 1] + t[runs / 2]) / 2;
+        if (csv)
+            printf("%s,%.2f,%.2f,%.2f\n", selected[k]->name, median, t.front(), t.back());
+        else
+            printf("%-45s %8.2f ns/call  (%.2f - %.2f)\n", selected[k]->name, median, t.front(), t.back());
+    }
+    return 0;
+}
+#endif
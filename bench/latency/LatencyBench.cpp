@@ -0,0 +1,319 @@
+/**
+ * VroomLamp/bench/latency/LatencyBench.cpp
+ *
+ * End-to-end shift-to-light latency benchmark for the native target.
+ *  Drives stick movements (synthetic or recorded) through the unmodified firmware (setup()/loop() in
+ *  src/main.cpp) on the simulated hardware, and measures the time from the stick physically settling
+ *  in a gear to the first strip.show() that carries that gear's color (and to the first change of color,
+ *  which comes earlier when animations crossfade).
+ *
+ * Every EEPROM slot is loaded with a distinct solid color so that the first correct pixel is unambiguous.
+ * Tuning values come from LampConfig.h and can be overridden with build_flags (e.g. -DT_SETTLE=100).
+ *
+ * Usage: program [--csv file] [--shifts n] [--seed n] [--noise counts] [--move min max] [--hold ms] [--loop-us us]
+ *  Recorded CSV rows are "t_ms,stick1,stick2,gear" where gear is 0 (R) - 6 while the stick is at rest and 7 while moving.
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Adafruit_NeoPixel.h>
+#include <AnimationDriver.h>
+#include <LampConfig.h>
+#include <LampSim.h>
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    // A stick reading at a point in time, with the gear the stick is physically resting in (7 while moving)
+    struct sample
+    {
+        unsigned long t;
+        int stick1;
+        int stick2;
+        uint8_t gear;
+    };
+
+    // A shift whose first correct pixel has not been seen yet
+    struct pendingShift
+    {
+        bool active;
+        uint8_t from;
+        uint8_t to;
+        unsigned long settleUs;
+        bool responded;
+        bool spurious;
+    };
+
+    const int gearCenters[7][2] = {{GR_1, GR_2}, {G1_1, G1_2}, {G2_1, G2_2}, {G3_1, G3_2}, {G4_1, G4_2}, {G5_1, G5_2}, {G6_1, G6_2}};
+    // R is always black in the firmware, the rest are written into the EEPROM slots
+    const uint8_t gearColors[7][3] = {{0, 0, 0}, {255, 255, 255}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 0}, {0, 255, 255}};
+
+    pendingShift pending;
+    std::vector<long> latencies; // microseconds, relative to physical settle
+    std::vector<long> onsets;    // first change away from the old gear's color, relative to physical settle
+    unsigned long misses = 0;
+    unsigned long spuriousShifts = 0;
+
+    uint32_t rngState = 1;
+    uint32_t rng()
+    {
+        rngState ^= rngState << 13;
+        rngState ^= rngState >> 17;
+        rngState ^= rngState << 5;
+        return rngState;
+    }
+    int noise(int amplitude) { return amplitude ? (int)(rng() % (2 * amplitude + 1)) - amplitude : 0; }
+
+    uint32_t gearColor(uint8_t gear) { return Adafruit_NeoPixel::Color(gearColors[gear][0], gearColors[gear][1], gearColors[gear][2]); }
+
+    void onShow(const uint32_t *pixels, uint16_t)
+    {
+        if (!pending.active)
+        {
+            return;
+        }
+        long latency = (long)(LampSim::nowMicros() - pending.settleUs);
+        if (!pending.responded && pixels[0] != gearColor(pending.from))
+        {
+            onsets.push_back(latency);
+            pending.responded = true;
+        }
+        if (pixels[0] == gearColor(pending.to))
+        {
+            latencies.push_back(latency);
+            pending.active = false;
+            return;
+        }
+        for (uint8_t gear = 0; gear < 7; gear++)
+        {
+            if (gear != pending.from && pixels[0] == gearColor(gear) && !pending.spurious)
+            {
+                // Another gear's animation flashed up on the way to the target
+                pending.spurious = true;
+                spuriousShifts++;
+            }
+        }
+    }
+
+    void writeBenchAnimations()
+    {
+        for (uint8_t i = 0; i < GEAR_COUNT; i++)
+        {
+            AnimationDriver::animation anim;
+            for (uint8_t f = 0; f < 2; f++)
+            {
+                memcpy(anim.frames[f].color, gearColors[i + 1], 3);
+                anim.frames[f].time = f * 1000;
+            }
+            anim.frameCount = 2;
+            anim.time = 1000;
+            EEPROM.put((int)(i * sizeof(AnimationDriver::animation)), anim);
+            EEPROM.update(GEAR_MAP_ADDR + i, i);
+        }
+    }
+
+    // Builds a sequence of random shifts sampled every millisecond
+    std::vector<sample> syntheticTrace(unsigned long shifts, int amplitude, unsigned long moveMin, unsigned long moveMax, unsigned long hold)
+    {
+        std::vector<sample> trace;
+        uint8_t gear = 1;
+        unsigned long t = 0;
+        for (unsigned long shift = 0; shift <= shifts; shift++)
+        {
+            // Rest in the current gear
+            for (unsigned long i = 0; i < hold; i++, t++)
+            {
+                trace.push_back({t, gearCenters[gear][0] + noise(amplitude), gearCenters[gear][1] + noise(amplitude), gear});
+            }
+            if (shift == shifts)
+            {
+                break;
+            }
+            // Move in a straight line to a different gear
+            uint8_t next = gear;
+            while (next == gear)
+            {
+                next = rng() % 7;
+            }
+            unsigned long moveTime = moveMin + rng() % (moveMax - moveMin + 1);
+            for (unsigned long i = 0; i < moveTime; i++, t++)
+            {
+                long s1 = gearCenters[gear][0] + ((long)gearCenters[next][0] - gearCenters[gear][0]) * (long)i / (long)moveTime;
+                long s2 = gearCenters[gear][1] + ((long)gearCenters[next][1] - gearCenters[gear][1]) * (long)i / (long)moveTime;
+                trace.push_back({t, (int)s1 + noise(amplitude), (int)s2 + noise(amplitude), 7});
+            }
+            gear = next;
+        }
+        return trace;
+    }
+
+    bool loadTrace(const char *path, std::vector<sample> &trace)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            return false;
+        }
+        char line[128];
+        while (fgets(line, sizeof(line), f))
+        {
+            unsigned long t;
+            int s1, s2, gear;
+            if (sscanf(line, "%lu,%d,%d,%d", &t, &s1, &s2, &gear) == 4)
+            {
+                trace.push_back({t, s1, s2, (uint8_t)(gear >= 0 && gear < 7 ? gear : 7)});
+            }
+        }
+        fclose(f);
+        return !trace.empty();
+    }
+
+    long floorDiv(long a, long b) { return a / b - (a % b < 0 ? 1 : 0); }
+
+    long percentile(const std::vector<long> &sorted, unsigned int p) { return sorted[(sorted.size() - 1) * p / 100]; }
+
+    void printDistribution(const char *label, const std::vector<long> &samples)
+    {
+        if (samples.empty())
+        {
+            return;
+        }
+        std::vector<long> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        long long sum = 0;
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            sum += sorted[i];
+        }
+        printf("%s (ms): min %.1f  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", label,
+               sorted.front() / 1000.0, sum / (double)sorted.size() / 1000.0, percentile(sorted, 50) / 1000.0,
+               percentile(sorted, 90) / 1000.0, percentile(sorted, 99) / 1000.0, sorted.back() / 1000.0);
+
+        // Histogram in 20 ms buckets
+        const long bucket = 20000;
+        long first = floorDiv(sorted.front(), bucket);
+        long last = floorDiv(sorted.back(), bucket);
+        for (long b = first; b <= last; b++)
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < sorted.size(); i++)
+            {
+                count += floorDiv(sorted[i], bucket) == b;
+            }
+            printf("%5ld..%5ld ms %6lu ", b * bucket / 1000, (b + 1) * bucket / 1000, (unsigned long)count);
+            for (size_t i = 0; i < count * 60 / sorted.size(); i++)
+            {
+                putchar('#');
+            }
+            putchar('\n');
+        }
+    }
+
+    void report(unsigned long loopCost, unsigned long passes)
+    {
+        printf("config: T_SETTLE=%d MOVE_THRES=%d MOVE_GAIN=%d T_MOVE_LOOP=%d FILTER_BUFF=%d T_MOTOR=%d T_FADE=%d RENDER_FPS=%d loop-us=%lu\n",
+               T_SETTLE, MOVE_THRES, MOVE_GAIN, T_MOVE_LOOP, FILTER_BUFF, T_MOTOR, T_FADE, RENDER_FPS, loopCost);
+        printf("passes: %lu, mean pass: %lu us\n", passes, passes ? LampSim::nowMicros() / passes : 0);
+        printf("shifts: %lu measured, %lu missed, %lu with a wrong gear shown on the way\n",
+               (unsigned long)latencies.size(), misses, spuriousShifts);
+        printDistribution("settle -> first change of color", onsets);
+        printDistribution("settle -> first correct pixel", latencies);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *csv = 0;
+    unsigned long shifts = 500, moveMin = 60, moveMax = 250, hold = 1000, loopCost = 300;
+    int amplitude = 3;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+            csv = argv[++i];
+        else if (!strcmp(argv[i], "--shifts") && i + 1 < argc)
+            shifts = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            rngState = strtoul(argv[++i], 0, 10) | 1;
+        else if (!strcmp(argv[i], "--noise") && i + 1 < argc)
+            amplitude = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--move") && i + 2 < argc)
+        {
+            moveMin = strtoul(argv[++i], 0, 10);
+            moveMax = std::max(moveMin, strtoul(argv[++i], 0, 10));
+        }
+        else if (!strcmp(argv[i], "--hold") && i + 1 < argc)
+            hold = strtoul(argv[++i], 0, 10);
+        else if (!strcmp(argv[i], "--loop-us") && i + 1 < argc)
+            loopCost = strtoul(argv[++i], 0, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [--csv file] [--shifts n] [--seed n] [--noise counts] [--move min max] [--hold ms] [--loop-us us]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<sample> trace;
+    if (csv)
+    {
+        if (!loadTrace(csv, trace))
+        {
+            fprintf(stderr, "could not read trace %s\n", csv);
+            return 1;
+        }
+    }
+    else
+    {
+        trace = syntheticTrace(shifts, amplitude, moveMin, moveMax, hold);
+    }
+
+    writeBenchAnimations();
+    LampSim::setShowHook(onShow);
+    LampSim::setAnalog(POT_PIN, 1023);
+
+    // Align the trace with the simulated clock, with the stick resting where the trace begins
+    unsigned long base = LampSim::nowMicros() - trace.front().t * 1000;
+    LampSim::setAnalog(STICK_PIN_1, trace.front().stick1);
+    LampSim::setAnalog(STICK_PIN_2, trace.front().stick2);
+    setup();
+
+    uint8_t restGear = trace.front().gear;
+    unsigned long passes = 0;
+    size_t idx = 0;
+    unsigned long end = base + (trace.back().t + 1) * 1000;
+    while (LampSim::nowMicros() < end)
+    {
+        // Apply the latest sample at the current time
+        while (idx + 1 < trace.size() && base + trace[idx + 1].t * 1000 <= LampSim::nowMicros())
+        {
+            idx++;
+            const sample &s = trace[idx];
+            if (s.gear < 7 && s.gear != restGear)
+            {
+                if (pending.active)
+                {
+                    misses++;
+                }
+                pending = {true, restGear, s.gear, base + s.t * 1000, false, false};
+            }
+            if (s.gear < 7)
+            {
+                restGear = s.gear;
+            }
+        }
+        LampSim::setAnalog(STICK_PIN_1, trace[idx].stick1);
+        LampSim::setAnalog(STICK_PIN_2, trace[idx].stick2);
+
+        loop();
+        LampSim::advanceMicros(loopCost);
+        passes++;
+    }
+    if (pending.active)
+    {
+        misses++;
+    }
+
+    report(loopCost, passes);
+    return 0;
+}
@@ -0,0 +1,246 @@
+/**
+ * VroomLamp/bench/sync/SyncBench.cpp
+ *
+ * Multi-lamp phase sync test for the native target.
+ *  Runs the unmodified firmware (setup()/loop() in src/main.cpp) on the simulated hardware in real time, with
+ *  its serial port on a pty so that two instances can be linked: the sync master creates the pty pair and
+ *  prints the follower's end, the follower opens it. Each instance can run its clock fast or slow (--drift)
+ *  and logs its animation time against the host's monotonic clock; --compare lines two logs up and reports
+ *  how far apart the lamps' animation clocks are.
+ *
+ * Usage:
+ *  program --master [--drift ppm] [--seconds n] [--log file]
+ *  program --follow /dev/pts/N [--drift ppm] [--seconds n] [--log file]
+ *  program --compare master.log follower.log [--skip seconds]
+ *  e.g. ./program --master --log m.log & sleep 1; ./program --follow /dev/pts/3 --drift 800 --log f.log; wait
+ *       ./program --compare m.log f.log --skip 10
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <AnimationDriver.h>
+#include <LampConfig.h>
+#include <LampSim.h>
+#include <SyncClock.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    struct logEntry
+    {
+        double wallMs;
+        double animMs;
+    };
+
+    double wallMs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+    }
+
+    // Raw mode, so the tty layer passes beacons through untouched
+    void makeRaw(int fd)
+    {
+        termios tio;
+        if (tcgetattr(fd, &tio) == 0)
+        {
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+    }
+
+    bool loadLog(const char *path, std::vector<logEntry> &entries)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            return false;
+        }
+        logEntry e;
+        while (fscanf(f, "%lf,%lf", &e.wallMs, &e.animMs) == 2)
+        {
+            entries.push_back(e);
+        }
+        fclose(f);
+        return entries.size() >= 2;
+    }
+
+    int compare(const char *masterPath, const char *followerPath, double skip)
+    {
+        std::vector<logEntry> master, follower;
+        if (!loadLog(masterPath, master) || !loadLog(followerPath, follower))
+        {
+            fprintf(stderr, "could not read logs\n");
+            return 1;
+        }
+        double start = std::max(master.front().wallMs, follower.front().wallMs) + skip * 1000;
+        std::vector<double> errors;
+        size_t m = 0;
+        for (size_t i = 0; i < follower.size(); i++)
+        {
+            const logEntry &f = follower[i];
+            if (f.wallMs < start)
+            {
+                continue;
+            }
+            while (m + 1 < master.size() && master[m + 1].wallMs < f.wallMs)
+            {
+                m++;
+            }
+            if (m + 1 >= master.size() || master[m].wallMs > f.wallMs)
+            {
+                continue;
+            }
+            // Master's animation time at the follower's sample, interpolated
+            const logEntry &a = master[m];
+            const logEntry &b = master[m + 1];
+            double anim = a.animMs + (b.animMs - a.animMs) * (f.wallMs - a.wallMs) / (b.wallMs - a.wallMs);
+            errors.push_back(f.animMs - anim);
+        }
+        if (errors.empty())
+        {
+            fprintf(stderr, "logs do not overlap\n");
+            return 1;
+        }
+        double sum = 0, worst = 0;
+        for (size_t i = 0; i < errors.size(); i++)
+        {
+            sum += errors[i];
+            worst = std::max(worst, fabs(errors[i]));
+        }
+        std::vector<double> sorted(errors);
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            sorted[i] = fabs(sorted[i]);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        printf("samples: %lu, follower - master (ms): mean %.2f  |p50| %.2f  |p99| %.2f  |max| %.2f\n",
+               (unsigned long)errors.size(), sum / errors.size(), sorted[sorted.size() / 2],
+               sorted[(sorted.size() - 1) * 99 / 100], worst);
+        return 0;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool master = false;
+    const char *follow = 0;
+    const char *logPath = 0;
+    const char *comparePaths[2] = {0, 0};
+    double drift = 0, seconds = 30, skip = 5;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--master"))
+            master = true;
+        else if (!strcmp(argv[i], "--follow") && i + 1 < argc)
+            follow = argv[++i];
+        else if (!strcmp(argv[i], "--drift") && i + 1 < argc)
+            drift = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--log") && i + 1 < argc)
+            logPath = argv[++i];
+        else if (!strcmp(argv[i], "--compare") && i + 2 < argc)
+        {
+            comparePaths[0] = argv[++i];
+            comparePaths[1] = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--skip") && i + 1 < argc)
+            skip = atof(argv[++i]);
+        else
+        {
+            master = false;
+            follow = 0;
+            comparePaths[0] = 0;
+            break;
+        }
+    }
+    if (comparePaths[0])
+    {
+        return compare(comparePaths[0], comparePaths[1], skip);
+    }
+    if (master == (follow != 0))
+    {
+        fprintf(stderr, "usage: %s --master | --follow pty [--drift ppm] [--seconds n] [--log file]\n"
+                        "       %s --compare master.log follower.log [--skip seconds]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    int fd;
+    if (master)
+    {
+        fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) || unlockpt(fd))
+        {
+            perror("pty");
+            return 1;
+        }
+        // Hold the follower's end open in raw mode, so beacons sent before it attaches neither fail nor get mangled
+        int peer = open(ptsname(fd), O_RDWR | O_NOCTTY);
+        makeRaw(peer);
+        printf("pty: %s\n", ptsname(fd));
+        fflush(stdout);
+        EEPROM.update(SYNC_ROLE_ADDR, SYNC_MASTER_ROLE);
+    }
+    else
+    {
+        fd = open(follow, O_RDWR | O_NOCTTY);
+        if (fd < 0)
+        {
+            perror(follow);
+            return 1;
+        }
+        makeRaw(fd);
+        // Join the line as it is now, like a lamp powered up after the master
+        tcflush(fd, TCIFLUSH);
+    }
+    // The link is one way, like a master's TX wired to the followers' RX: the follower's replies stay local
+    LampSim::serialAttach(master ? -1 : fd, master ? fd : -1);
+    FILE *log = logPath ? fopen(logPath, "w") : 0;
+
+    // Rest the stick in gear 1 with the knob at full brightness
+    LampSim::setAnalog(POT_PIN, 1023);
+    LampSim::setAnalog(STICK_PIN_1, G1_1);
+    LampSim::setAnalog(STICK_PIN_2, G1_2);
+    setup();
+
+    // Run in real time, with this lamp's clock running fast or slow by the drift
+    double rate = 1 + drift / 1e6;
+    double start = wallMs();
+    unsigned long simStart = LampSim::nowMicros();
+    double nextLog = start;
+    while (wallMs() - start < seconds * 1000)
+    {
+        loop();
+        LampSim::advanceMicros(300);
+        double now = wallMs();
+        if (log && now >= nextLog)
+        {
+            fprintf(log, "%.3f,%lu\n", now, LampSync.now(millis()));
+            nextLog += 20;
+        }
+        double ahead = (LampSim::nowMicros() - simStart) / 1000.0 - (now - start) * rate;
+        if (ahead > 0)
+        {
+            usleep((useconds_t)(ahead * 1000 / rate));
+        }
+    }
+    if (log)
+    {
+        fclose(log);
+    }
+    printf("%s: sync %s, drift %d ppm, last error %ld ms\n", master ? "master" : "follower",
+           LampSync.isLocked() ? "locked" : "free", LampSync.drift(), LampSync.lastError());
+    return 0;
+}
@@ -0,0 +1,36 @@
+/**
+ * VroomLamp/hal/native/Adafruit_NeoPixel.h
+ *
+ * Host stand-in for the NeoPixel driver. Keeps the pixel buffer and reports every show() to the
+ *  simulation (see LampSim.h) instead of bit-banging a strip.
+ */
+#ifndef NATIVE_NEOPIXEL_H
+#define NATIVE_NEOPIXEL_H
+
+#include <stdint.h>
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel
+{
+private:
+    uint16_t _numLEDs;
+    uint32_t *_pixels;
+    uint8_t _brightness;
+
+public:
+    Adafruit_NeoPixel(uint16_t n, uint16_t pin, uint16_t type);
+    ~Adafruit_NeoPixel();
+    void begin() {}
+    void show();
+    void fill(uint32_t c);
+    void setPixelColor(uint16_t n, uint32_t c);
+    uint32_t getPixelColor(uint16_t n) const;
+    void setBrightness(uint8_t b) { _brightness = b; }
+    uint8_t getBrightness() const { return _brightness; }
+    uint16_t numPixels() const { return _numLEDs; }
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+};
+
+#endif
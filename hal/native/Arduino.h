@@ -0,0 +1,115 @@
+/**
+ * VroomLamp/hal/native/Arduino.h
+ *
+ * Minimal host stand-in for the Arduino core, used by the native (PC) builds.
+ *  Only the parts of the API the lamp firmware touches are provided. Time is simulated:
+ *  it only moves forward when the simulation (see LampSim.h) or a modelled peripheral advances it.
+ */
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+// Analog pin numbers as on the ATmega328 Nano
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define F(s) (s)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+int analogRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void pinMode(uint8_t pin, uint8_t mode);
+
+// Sketch entry points
+void setup();
+void loop();
+
+// Minimal String, backed by std::string
+class String
+{
+private:
+    std::string _s;
+
+public:
+    String() {}
+    String(const char *s) : _s(s) {}
+    String(const std::string &s) : _s(s) {}
+    char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    unsigned int length() const { return _s.size(); }
+    const char *c_str() const { return _s.c_str(); }
+    void operator+=(char c) { _s += c; }
+};
+
+// Serial port backed by in-memory queues (and optionally a pty, see LampSim.h)
+class SimSerial
+{
+public:
+    // received: run for each byte as it reaches the receive buffer, as from the firmware driver's interrupt
+    void begin(unsigned long baud, void (*received)(uint8_t) = 0);
+    int available();
+    int read();
+    int peek();
+    size_t readBytes(uint8_t *buff, size_t len);
+    size_t readBytes(char *buff, size_t len) { return readBytes((uint8_t *)buff, len); }
+    String readStringUntil(char terminator);
+    void setTimeout(unsigned long ms) { _timeout = ms; }
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buff, size_t len);
+    void flush();
+    int availableForWrite(); // Always 63 unless the line is paced (LampSim::serialPace)
+
+    size_t print(const char *s);
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n);
+    size_t print(unsigned long n);
+    size_t print(int n) { return print((long)n); }
+    size_t print(unsigned int n) { return print((unsigned long)n); }
+    size_t print(unsigned char n) { return print((unsigned long)n); }
+    size_t println() { return print("\r\n"); }
+    template <typename T>
+    size_t println(T v)
+    {
+        size_t n = print(v);
+        return n + println();
+    }
+    operator bool() { return true; }
+
+    // Receive counters, as kept by the firmware's UART driver (UartSerial.h)
+    uint16_t rxLost();              // Bytes that found the receive buffer full (paced line only)
+    uint16_t rxLate() { return 0; } // The simulation never holds off the receive interrupt
+    uint8_t rxHighWater();          // Most bytes held in the receive buffer at once
+    uint8_t rxSize();               // Bytes the receive buffer can hold when the line is paced
+
+private:
+    unsigned long _timeout = 1000;
+    int timedRead();
+};
+
+extern SimSerial Serial;
+
+#endif
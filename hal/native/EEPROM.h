@@ -0,0 +1,51 @@
+/**
+ * VroomLamp/hal/native/EEPROM.h
+ *
+ * In-memory stand-in for the AVR EEPROM library (1 KB, erased to 0xFF like a fresh part).
+ */
+#ifndef NATIVE_EEPROM_H
+#define NATIVE_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define E2END 0x3FF
+
+class EEPROMClass
+{
+public:
+    uint8_t data[E2END + 1];
+    unsigned long reads = 0;  // Bytes read since start (used by the simulation cost model)
+    unsigned long writes = 0; // Bytes written since start
+
+    EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+    uint8_t read(int idx);
+    void write(int idx, uint8_t val);
+    void update(int idx, uint8_t val);
+    uint16_t length() { return E2END + 1; }
+
+    template <typename T>
+    T &get(int idx, T &t)
+    {
+        uint8_t *p = (uint8_t *)&t;
+        for (unsigned int i = 0; i < sizeof(T); i++)
+        {
+            p[i] = read(idx + i);
+        }
+        return t;
+    }
+    template <typename T>
+    const T &put(int idx, const T &t)
+    {
+        const uint8_t *p = (const uint8_t *)&t;
+        for (unsigned int i = 0; i < sizeof(T); i++)
+        {
+            update(idx + i, p[i]);
+        }
+        return t;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * VroomLamp/hal/native/LampSim.cpp
+ *
+ * Host implementations of the Arduino core, EEPROM and NeoPixel stand-ins.
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Adafruit_NeoPixel.h>
+#include <LampSim.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <deque>
+
+SimSerial Serial;
+EEPROMClass EEPROM;
+
+namespace
+{
+    unsigned long simMicros = 0;
+    int analogValues[A7 + 1];
+    uint8_t pinValues[A7 + 1];
+    LampSim::showHook onShow = 0;
+    LampSim::costModel model = {104, 30, 50, 1, 3400};
+    std::deque<uint8_t> rxQueue;
+    void (*onReceived)(uint8_t) = 0; // The receive interrupt's hook (SimSerial::begin)
+    std::deque<uint8_t> txQueue;
+    int rxFd = -1;
+    int txFd = -1;
+
+    // Real time: the simulated clock follows the host's monotonic clock
+    bool realTime = false;
+    unsigned long wallOffset; // Host time (us) at simulated time 0
+
+    // Line pacing: bytes take byteMicros on the wire in each direction (0 for instant transfers)
+    struct timedByte
+    {
+        unsigned long due; // Simulated time the byte is through the UART
+        uint8_t value;
+    };
+    unsigned long byteMicros = 0;
+    std::deque<timedByte> rxLine; // Received, still on the wire
+    std::deque<timedByte> txLine; // Written, still in the transmit buffer or on the wire
+    unsigned long rxFree = 0;     // Time the receive line is free for the next byte
+    unsigned long txFree = 0;
+    unsigned long rxDropped = 0;
+    size_t rxHeldMax = 0;
+
+    // Receive and transmit buffer sizes (one slot of each ring stays empty)
+    size_t rxBuffer = 63;
+    const size_t TX_BUFFER = 63;
+
+    void noteHeld()
+    {
+        if (rxQueue.size() > rxHeldMax)
+        {
+            rxHeldMax = rxQueue.size();
+        }
+    }
+
+    // A byte reaches the receive buffer
+    void receive(uint8_t c)
+    {
+        rxQueue.push_back(c);
+        if (onReceived)
+        {
+            onReceived(c);
+        }
+    }
+
+    unsigned long hostMicros()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+    }
+
+    // Keeps the simulated clock on the host's: catches up when behind, sleeps off modelled costs that ran well ahead
+    void syncClock()
+    {
+        if (!realTime)
+        {
+            return;
+        }
+        unsigned long wall = hostMicros() - wallOffset;
+        long ahead = (long)(simMicros - wall);
+        if (ahead > 2000)
+        {
+            usleep(ahead);
+        }
+        else if (ahead < 0)
+        {
+            simMicros = wall;
+        }
+    }
+
+    bool due(const timedByte &b) { return (long)(simMicros - b.due) >= 0; }
+
+    void send(const uint8_t *buff, size_t len)
+    {
+        if (txFd >= 0)
+        {
+            // Like a UART, bytes nobody is reading are lost rather than holding up the sender
+            ssize_t n = ::write(txFd, buff, len);
+            (void)n;
+            return;
+        }
+        txQueue.insert(txQueue.end(), buff, buff + len);
+    }
+
+    // Moves whatever has arrived on the attached descriptor into the receive queue, and bytes that have
+    //  crossed the line (when paced) out of it
+    void pump()
+    {
+        syncClock();
+        if (rxFd >= 0)
+        {
+            uint8_t buff[256];
+            ssize_t n;
+            while ((n = ::read(rxFd, buff, sizeof(buff))) > 0)
+            {
+                if (!byteMicros)
+                {
+                    for (ssize_t i = 0; i < n; i++)
+                    {
+                        receive(buff[i]);
+                    }
+                    noteHeld();
+                    continue;
+                }
+                for (ssize_t i = 0; i < n; i++)
+                {
+                    rxFree = ((long)(rxFree - simMicros) > 0 ? rxFree : simMicros) + byteMicros;
+                    rxLine.push_back(timedByte{rxFree, buff[i]});
+                }
+            }
+        }
+        while (!rxLine.empty() && due(rxLine.front()))
+        {
+            // A full receive buffer drops the byte, as the UART interrupt does
+            if (rxQueue.size() < rxBuffer)
+                receive(rxLine.front().value);
+            else
+                rxDropped++;
+            rxLine.pop_front();
+        }
+        noteHeld();
+        uint8_t out[256];
+        size_t n = 0;
+        while (!txLine.empty() && due(txLine.front()) && n < sizeof(out))
+        {
+            out[n++] = txLine.front().value;
+            txLine.pop_front();
+        }
+        if (n)
+        {
+            send(out, n);
+        }
+    }
+} // namespace
+
+namespace LampSim
+{
+    costModel &costs() { return model; }
+    void setAnalog(uint8_t pin, int value) { analogValues[pin] = value; }
+    void setShowHook(showHook hook) { onShow = hook; }
+    // Time passing is when the receive interrupt gets to run, if nothing reads the port
+    void advanceMicros(unsigned long us)
+    {
+        simMicros += us;
+        pump();
+    }
+    unsigned long nowMicros() { return simMicros; }
+
+    void notifyShow(const uint32_t *pixels, uint16_t count)
+    {
+        advanceMicros(model.showPerLED * count + model.showLatch);
+        if (onShow)
+        {
+            onShow(pixels, count);
+        }
+    }
+
+    void sleepUntilInterrupt()
+    {
+        pump();
+        if (!rxQueue.empty())
+        {
+            return;
+        }
+        // The millis() tick, or a byte coming off the line
+        unsigned long next = simMicros + 1000 - simMicros % 1000;
+        if (!rxLine.empty() && (long)(next - rxLine.front().due) > 0)
+        {
+            next = rxLine.front().due;
+        }
+        if (!realTime)
+        {
+            simMicros = next;
+            pump();
+            return;
+        }
+        long wait = (long)(next - (hostMicros() - wallOffset));
+        if (wait > 0)
+        {
+            pollfd fd = {rxFd, POLLIN, 0};
+            timespec timeout = {0, wait * 1000L};
+            if (ppoll(&fd, rxFd >= 0 ? 1 : 0, &timeout, 0) == 0 && (long)(next - simMicros) > 0)
+            {
+                simMicros = next;
+            }
+        }
+        pump();
+    }
+
+    void setRealTime(bool on)
+    {
+        realTime = on;
+        wallOffset = hostMicros() - simMicros;
+    }
+
+    void serialPace(unsigned long baud, size_t rx)
+    {
+        byteMicros = baud ? (10000000UL + baud / 2) / baud : 0;
+        rxBuffer = rx;
+    }
+    bool serialLive() { return realTime || byteMicros; }
+
+    void serialInject(const uint8_t *buff, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            receive(buff[i]);
+        }
+        noteHeld();
+    }
+
+    void serialAttach(int rx, int tx)
+    {
+        rxFd = rx;
+        txFd = tx;
+        if (rx >= 0)
+        {
+            fcntl(rx, F_SETFL, fcntl(rx, F_GETFL) | O_NONBLOCK);
+        }
+        if (tx >= 0)
+        {
+            fcntl(tx, F_SETFL, fcntl(tx, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    size_t serialTake(uint8_t *buff, size_t len)
+    {
+        pump();
+        size_t n = 0;
+        while (n < len && !txQueue.empty())
+        {
+            buff[n++] = txQueue.front();
+            txQueue.pop_front();
+        }
+        return n;
+    }
+} // namespace LampSim
+
+// Arduino core
+unsigned long millis() { return simMicros / 1000; }
+unsigned long micros() { return simMicros; }
+void delay(unsigned long ms) { simMicros += ms * 1000; }
+void delayMicroseconds(unsigned int us) { simMicros += us; }
+int analogRead(uint8_t pin)
+{
+    simMicros += model.analogRead;
+    return pin <= A7 ? analogValues[pin] : 0;
+}
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin <= A7)
+        pinValues[pin] = val;
+}
+int digitalRead(uint8_t pin) { return pin <= A7 ? pinValues[pin] : LOW; }
+void pinMode(uint8_t, uint8_t) {}
+
+// Serial
+void SimSerial::begin(unsigned long, void (*received)(uint8_t)) { onReceived = received; }
+int SimSerial::available()
+{
+    pump();
+    return rxQueue.size();
+}
+int SimSerial::peek()
+{
+    pump();
+    return rxQueue.empty() ? -1 : rxQueue.front();
+}
+int SimSerial::read()
+{
+    pump();
+    if (rxQueue.empty())
+        return -1;
+    uint8_t b = rxQueue.front();
+    rxQueue.pop_front();
+    return b;
+}
+// Waits up to the timeout for a byte when the line is live (bytes still to come), like Stream::timedRead()
+int SimSerial::timedRead()
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = read();
+        if (c >= 0 || !LampSim::serialLive())
+            return c;
+        LampSim::sleepUntilInterrupt();
+    } while (millis() - start < _timeout);
+    return -1;
+}
+size_t SimSerial::readBytes(uint8_t *buff, size_t len)
+{
+    size_t n = 0;
+    int c;
+    while (n < len && (c = timedRead()) >= 0)
+    {
+        buff[n++] = (uint8_t)c;
+    }
+    return n;
+}
+String SimSerial::readStringUntil(char terminator)
+{
+    std::string s;
+    int c;
+    while ((c = timedRead()) >= 0 && c != terminator)
+    {
+        s += (char)c;
+    }
+    return String(s);
+}
+size_t SimSerial::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+size_t SimSerial::write(const uint8_t *buff, size_t len)
+{
+    if (!byteMicros)
+    {
+        // In real time, not before the host has caught up with the modelled costs
+        syncClock();
+        send(buff, len);
+        return len;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        // Blocks while the transmit buffer is full, as HardwareSerial does
+        while (txLine.size() > TX_BUFFER)
+        {
+            if (!due(txLine.front()))
+                simMicros = txLine.front().due;
+            pump();
+        }
+        txFree = ((long)(txFree - simMicros) > 0 ? txFree : simMicros) + byteMicros;
+        txLine.push_back(timedByte{txFree, buff[i]});
+    }
+    return len;
+}
+int SimSerial::availableForWrite()
+{
+    return txLine.size() > TX_BUFFER ? 0 : TX_BUFFER - txLine.size();
+}
+uint16_t SimSerial::rxLost() { return rxDropped > 0xFFFF ? 0xFFFF : rxDropped; }
+uint8_t SimSerial::rxHighWater() { return rxHeldMax > 0xFF ? 0xFF : rxHeldMax; }
+uint8_t SimSerial::rxSize() { return rxBuffer > 0xFF ? 0xFF : rxBuffer; }
+void SimSerial::flush()
+{
+    // Waits for the last byte to leave
+    if (!txLine.empty() && !due(txLine.back()))
+    {
+        simMicros = txLine.back().due;
+    }
+    pump();
+}
+size_t SimSerial::print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+size_t SimSerial::print(long n)
+{
+    char buff[24];
+    snprintf(buff, sizeof(buff), "%ld", n);
+    return print(buff);
+}
+size_t SimSerial::print(unsigned long n)
+{
+    char buff[24];
+    snprintf(buff, sizeof(buff), "%lu", n);
+    return print(buff);
+}
+
+// EEPROM
+uint8_t EEPROMClass::read(int idx)
+{
+    simMicros += model.eepromRead;
+    reads++;
+    return data[idx & E2END];
+}
+void EEPROMClass::write(int idx, uint8_t val)
+{
+    simMicros += model.eepromWrite;
+    writes++;
+    data[idx & E2END] = val;
+}
+void EEPROMClass::update(int idx, uint8_t val)
+{
+    if (read(idx) != val)
+    {
+        write(idx, val);
+    }
+}
+
+// NeoPixel
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, uint16_t, uint16_t) : _numLEDs(n), _brightness(0)
+{
+    _pixels = new uint32_t[n]();
+}
+Adafruit_NeoPixel::~Adafruit_NeoPixel() { delete[] _pixels; }
+void Adafruit_NeoPixel::show() { LampSim::notifyShow(_pixels, _numLEDs); }
+void Adafruit_NeoPixel::fill(uint32_t c)
+{
+    for (uint16_t i = 0; i < _numLEDs; i++)
+        _pixels[i] = c;
+}
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c)
+{
+    if (n < _numLEDs)
+        _pixels[n] = c;
+}
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const { return n < _numLEDs ? _pixels[n] : 0; }
@@ -0,0 +1,53 @@
+/**
+ * VroomLamp/hal/native/LampSim.h
+ *
+ * Control surface for the native simulation of the lamp hardware.
+ *  The simulated clock is advanced by the modelled cost of each peripheral access (ADC conversion,
+ *  strip refresh, EEPROM access) so that timing measured on the host tracks the real Nano.
+ */
+#ifndef LAMP_SIM_H
+#define LAMP_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace LampSim
+{
+    // Modelled execution cost of hardware accesses (microseconds)
+    struct costModel
+    {
+        unsigned long analogRead;  // One ADC conversion (13 ADC clocks at 125 kHz)
+        unsigned long showPerLED;  // WS2812 transfer per pixel (24 bits at 800 kHz)
+        unsigned long showLatch;   // Strip latch/reset time
+        unsigned long eepromRead;  // Per byte read
+        unsigned long eepromWrite; // Per byte written (erase + write)
+    };
+
+    // Called on every strip.show() with the pixel buffer (0x00RRGGBB, before brightness scaling)
+    typedef void (*showHook)(const uint32_t *pixels, uint16_t count);
+
+    costModel &costs();
+    void setAnalog(uint8_t pin, int value);
+    void setShowHook(showHook hook);
+    void advanceMicros(unsigned long us);
+    unsigned long nowMicros();
+    void notifyShow(const uint32_t *pixels, uint16_t count);
+    void sleepUntilInterrupt(); // Advances to the next millis() tick, unless serial data is waiting
+    // Real time: the simulated clock follows the host's (modelled costs that run ahead of it are slept off) and
+    //  sleepUntilInterrupt() waits for the tick or for serial data
+    void setRealTime(bool on);
+
+    // Serial loopback for driving the protocol from the host
+    void serialInject(const uint8_t *buff, size_t len);
+    size_t serialTake(uint8_t *buff, size_t len);
+    // Connects the serial port's receive and transmit lines to file descriptors (e.g. a pty) instead of the
+    //  loopback queues, -1 leaves that direction on the loopback
+    void serialAttach(int rx, int tx);
+    // Paces both directions to a baud rate (10 bits per byte) with a 64 byte transmit buffer and a receive buffer of
+    //  rxBuffer bytes: writes block while the transmit buffer is full, received bytes overflowing the receive buffer
+    //  are dropped. 0 turns it off
+    void serialPace(unsigned long baud, size_t rxBuffer = 63);
+    bool serialLive();             // Whether reads should wait for bytes still to come (real time or paced)
+} // namespace LampSim
+
+#endif
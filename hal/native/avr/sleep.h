@@ -0,0 +1,18 @@
+/**
+ * VroomLamp/hal/native/avr/sleep.h
+ *
+ * Host stand-in for avr-libc sleep modes: sleeping advances the simulated clock to the next
+ *  interrupt (the millis() timer tick, or straight away if serial data is waiting).
+ */
+#ifndef NATIVE_AVR_SLEEP_H
+#define NATIVE_AVR_SLEEP_H
+
+#include <LampSim.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+
+inline void set_sleep_mode(uint8_t) {}
+inline void sleep_mode() { LampSim::sleepUntilInterrupt(); }
+
+#endif
@@ -1,48 +1,181 @@
+#ifndef ANIMATION
 #include <stdint.h>
 #define ANIMATION // Used to stop duplicate imports
 
 namespace AnimationDriver
 {
 
+    // Easing applied over the segment that starts at a frame
+    enum easing : uint8_t
+    {
+        LINEAR,      // Straight blend (default)
+        STEP,        // Hold this frame's color until the next frame
+        EASE_IN,     // Quadratic, slow start
+        EASE_OUT,    // Quadratic, slow end
+        EASE_IN_OUT, // Cubic smoothstep
+        SINE,        // Half cosine, slow start and end
+        CUBIC_IN,    // Cubic, slow start
+        CUBIC_OUT,   // Cubic, slow end
+    };
+
+    // The easing lives in the top bits of a frame's time (so frames keep their size and serial format)
+#define EASE_SHIFT 29
+#define FRAME_TIME_MASK ((1UL << EASE_SHIFT) - 1)
+
     // Structure that holds a single frame of an animation
     struct animFrame
     {
         uint8_t color[3]; // Color at this frame
-        uint32_t time;    // time in ms from the animation's start where this frame occurs
+        uint32_t time;    // time in ms from the animation's start where this frame occurs (easing in the top 3 bits)
     };
 
+    // Flag in an animation's frameCount: frame colors are (hue, saturation, value) and are blended in HSV
+    //  Hue always travels forward (increasing, wrapping at 255), so a full hue sweep takes 2 frames (hue 0 -> 255)
+#define HSV_FLAG 0x80
+    // Flag in an animation's frameCount: the frames area holds a ScriptVM program (count blocks of 7 bytes) instead of frames
+#define SCRIPT_FLAG 0x40
+#define FRAME_COUNT(count) ((count) & ~(HSV_FLAG | SCRIPT_FLAG))
+
+    // Frame time with an easing for the segment that starts at it
+    constexpr uint32_t easedTime(uint32_t time, easing ease) { return time | ((uint32_t)ease << EASE_SHIFT); }
+
     // Structure that holds an entire animation
     struct animation
     {
         animFrame frames[20]; // List of frames (fixed size array)
-        uint8_t frameCount;   // Number of entries with useful data in the frames buffer
+        uint8_t frameCount;   // Number of entries with useful data in the frames buffer (may carry HSV_FLAG or SCRIPT_FLAG)
         uint32_t time;        // Total runtime of this animation (redundant with "time" member of last relevant item in frames array)
     };
 
+    // Exactly-sized animation stored in flash (PROGMEM), see DefaultAnimations.h
+    struct flashAnimation
+    {
+        const animFrame *frames; // Frames (also in flash)
+        uint8_t frameCount;      // Number of frames (may carry HSV_FLAG)
+        uint32_t time;           // Total runtime of this animation
+    };
+
+    // Integer HSV to RGB, hue in 1/256 steps over the full circle (0 - 65535)
+    void hsvToRgb(uint16_t hue, uint8_t sat, uint8_t val, uint8_t *rgb);
+
+    // Eased segment progress (0 - 256) for a linear progress (0 - 256)
+    uint16_t applyEasing(easing ease, uint16_t progress);
+
+    // Blends two frame colors by progress (0 - 256), in H,S,V (hue travelling forward) if hsv is set, into an RGB color
+    void blendColor(const uint8_t *from, const uint8_t *to, uint16_t progress, bool hsv, uint8_t *rgb);
+
+    // Blends two channel values by progress (0 - 256)
+    inline uint8_t blend(uint8_t from, uint8_t to, uint16_t progress)
+    {
+        if (to >= from)
+        {
+            return from + (uint8_t)(((uint16_t)(to - from) * progress + 128) >> 8);
+        }
+        return from - (uint8_t)(((uint16_t)(from - to) * progress + 128) >> 8);
+    }
+
     // Typedef for parent function that will call actually drive the LEDs
     typedef void (*drivingFunc)(uint8_t, uint8_t, uint8_t);
     // Typedef for system time function
     typedef unsigned long (*sysTimeFunc)();
 
-    class AnimationDriver
+    /**
+     * Animation logic, with system time passed in by the caller
+     * The active animation is played in place (from SRAM or flash), only the two frames being
+     *  interpolated between are held in SRAM
+     */
+    class AnimationCore
     {
     private:
-        unsigned long currentTime;   // Current timestamp within animation
-        unsigned long lastStartTime; // System time of last animation start
-        animation activeAnimation;   // current animation running
-        uint8_t frameIndex;          // index of the current frame
+        unsigned long currentTime;        // Current timestamp within animation
+        unsigned long lastStartTime;      // System time of last animation start
+        const animFrame *activeFrames;    // frames of the current animation running
+        bool inFlash;                     // Whether the current animation is stored in flash (PROGMEM)
+        uint8_t frameCount;               // Frame count of the current animation
+        bool hsv;                         // Whether frames are blended in HSV
+        uint32_t period;                  // Total runtime of the current animation
+        animFrame lastFrame, nextFrame;   // Frames at frameIndex and frameIndex + 1 (times without easing bits)
+        easing ease;                      // Easing of the current segment
+        uint32_t segmentLength;           // Length of the current segment (ms, >> segmentShift)
+        uint8_t segmentShift;             // 8 for segments too long to scale progress within 32 bits, else 0
+        uint32_t segmentScale;            // 2^24 / segmentLength, so progress takes a multiply rather than a divide (0: divide)
+        uint8_t frameIndex;               // index of the current frame
         // Internal Color state
         uint8_t color[3];
+        // Crossfade into a new animation
+        uint8_t fromColor[3];          // Output color when the animation changed
+        unsigned long transitionStart; // System time the animation changed
+        uint16_t transitionTime;       // Crossfade length (0 for a hard cut)
+        bool fading;                   // Whether a crossfade is in progress
+        bool phaseLock;                // Start animations on a multiple of their period, so lamps sharing a clock stay in phase
+        // Output tracking, to skip work when the strip already shows the right color
+        bool isStatic;    // Every frame of the current animation has the same color
+        bool dirty;       // The strip needs a refresh even if the color has not changed
+        uint8_t shown[3]; // Color last returned by update()
+        bool scanStatic(); // Whether every frame of the current animation has the same color
+        void loadFrame(uint8_t, animFrame &); // Copy a frame of the current animation into SRAM
+        void loadFrames();                    // Load the frames around frameIndex
+        void updateTime(unsigned long);       // Update current time within animation
+        void advanceFrames();                 // Skip the periods and frames the current time has passed
+        void interpolateColor();              // Calculates current color
+
+    public:
+        AnimationCore();
+        void setTransition(uint16_t);                                // Set the crossfade length (ms) used when the animation changes
+        void setPhaseLock(bool);                                     // Align animation starts to multiples of their period on the system clock
+        void updateAnimation(const animation &, unsigned long);      // Play an animation in SRAM (must stay valid while playing)
+        void updateAnimation(const animation &&, unsigned long) = delete; // A temporary would not outlive the call
+        void updateAnimationP(const flashAnimation *, unsigned long); // Play an animation stored in flash
+        void restart(unsigned long);                                 // Used to reset all time-dependant logic
+        const uint8_t *render(unsigned long);                        // Advances the animation to a system time and returns the color state (r, g, b)
+        const uint8_t *update(unsigned long);                        // As render(), but returns null when the output has not changed since the last update()
+        void redraw();                                               // Makes the next update() return the color even if unchanged (e.g. after a brightness change)
+    };
+
+    /**
+     * Animation driver reading time from a clock policy providing a static "unsigned long now()"
+     * The driving function is a template parameter, so lambdas passed to run() can be inlined
+     */
+    template <class Clock>
+    class AnimationDriverT : public AnimationCore
+    {
+    public:
+        AnimationDriverT() {}
+        AnimationDriverT(const animation &initAnim) { updateAnimation(initAnim); }
+        AnimationDriverT(const animation &&) = delete;
+        void updateAnimation(const animation &newAnim) { AnimationCore::updateAnimation(newAnim, Clock::now()); }
+        void updateAnimation(const animation &&) = delete;
+        void updateAnimationP(const flashAnimation *newAnim) { AnimationCore::updateAnimationP(newAnim, Clock::now()); }
+        void restart() { AnimationCore::restart(Clock::now()); }
+
+        // Runs the animation logic and passes the color state to a callable taking (uint8_t r, uint8_t g, uint8_t b)
+        //  The callable is skipped when the output has not changed
+        template <class Drive>
+        void run(Drive runLEDs)
+        {
+            const uint8_t *c = update(Clock::now());
+            if (c)
+            {
+                runLEDs(c[0], c[1], c[2]);
+            }
+        }
+    };
+
+    // Function pointer based animation driver, kept for compatibility with other projects (keeps its own copy of the animation)
+    class AnimationDriver : public AnimationCore
+    {
+    private:
         sysTimeFunc _getSysTime;
-        void updateTime();       // Update current time within animation
-        void interpolateColor(); // Calculates current color
+        animation ownAnimation;
 
     public:
-        AnimationDriver(animation, sysTimeFunc);
+        AnimationDriver(const animation &, sysTimeFunc);
         AnimationDriver(sysTimeFunc);
-        void updateAnimation(animation);
-        void run(drivingFunc); // Takes a pointer to the parent function that runs hardware
+        void updateAnimation(const animation &);
+        void updateAnimationP(const flashAnimation *);
+        void run(drivingFunc); // Takes a pointer to the parent function that runs hardware (only called when the output changes)
         void restart();        // Used to reset all time-dependant logic
     };
 
-} // Namespace AnimationDriver
\ No newline at end of file
+} // Namespace AnimationDriver
+#endif
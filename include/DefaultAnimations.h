@@ -2,39 +2,177 @@
 #include <AnimationDriver.h>
 #endif
 
-// Macro used to generate struct for solid colors
-#define SOLID_COLOR(r, g, b) ((struct AnimationDriver::animation){{                     \
-                                                                      {{r, g, b}, 0},   \
-                                                                      {{r, g, b}, 500}, \
-                                                                  },                    \
-                                                                  2,                    \
-                                                                  100})
-
-// Macro used to generate struct for breathing animation
-#define BREATHE_COLOR(r, g, b, time) ((struct AnimationDriver::animation){{                                          \
-                                                                              {{r, g, b}, 0},                        \
-                                                                              {{r / 2, g / 2, b / 2}, time / 4},     \
-                                                                              {{0, 0, 0}, time / 2},                 \
-                                                                              {{r / 2, g / 2, b / 2}, time * 3 / 4}, \
-                                                                              {{r, g, b}, time},                     \
-                                                                          },                                         \
-                                                                          5,                                         \
-                                                                          time})
-
-#define RAINBOW(time) ((struct AnimationDriver::animation){{                                    \
-                                                               {{255, 0, 0}, 0},                \
-                                                               {{255, 127, 0}, time * 1 / 12},  \
-                                                               {{255, 255, 0}, time / 6},       \
-                                                               {{127, 255, 0}, time / 4},       \
-                                                               {{0, 255, 0}, time / 3},         \
-                                                               {{0, 255, 127}, time * 5 / 12},  \
-                                                               {{0, 255, 255}, time / 2},       \
-                                                               {{0, 127, 255}, time * 7 / 12},  \
-                                                               {{0, 0, 255}, time * 2 / 3},     \
-                                                               {{127, 0, 255}, time * 3 / 4},   \
-                                                               {{255, 0, 255}, time * 5 / 6},   \
-                                                               {{255, 0, 127}, time * 11 / 12}, \
-                                                               {{255, 0, 0}, time},             \
-                                                           },                                   \
-                                                           13,                                  \
-                                                           time})
+#ifndef DEFAULT_ANIMATIONS
+#define DEFAULT_ANIMATIONS
+
+/**
+ * Compile-time animation generators
+ *
+ * Each generator is a type describing an animation by its parameters:
+ *  frameCount: number of frames generated
+ *  time: total runtime (equal to the time of the last frame)
+ *  frame(i): the i-th frame (easing in the top bits of its time, see easedTime())
+ *  flags: flags added to the frame count (HSV_FLAG for frames in HSV), from rgbGenerator/hsvGenerator
+ * GENERATED_ANIMATION() expands one into an exactly-sized frame table in flash plus its flashAnimation header.
+ *  Frame times are rounded from the index (not accumulated), so odd durations do not drift, and the table is
+ *  checked with static_asserts (2 - 20 frames, first frame at 0, strictly increasing times, ends at "time").
+ *
+ * Example:
+ *  GENERATED_ANIMATION(Rainbow, AnimationDriver::Rainbow<4000UL, 6>);
+ *  animator.updateAnimationP(&Rainbow);
+ */
+namespace AnimationDriver
+{
+    // Frame table of an exact size
+    template <uint8_t N>
+    struct frameTable
+    {
+        animFrame frames[N];
+    };
+
+    namespace gen
+    {
+        // Compile-time index sequence (0 ... N-1)
+        template <uint8_t... I>
+        struct indices
+        {
+        };
+        template <uint8_t N, uint8_t... I>
+        struct makeIndices : makeIndices<N - 1, N - 1, I...>
+        {
+        };
+        template <uint8_t... I>
+        struct makeIndices<0, I...>
+        {
+            typedef indices<I...> type;
+        };
+
+        // Integer division rounded to nearest
+        constexpr uint32_t roundDiv(uint32_t num, uint32_t den) { return (num + den / 2) / den; }
+
+        // Time of step i out of n spread evenly over total
+        constexpr uint32_t stepTime(uint32_t total, uint32_t i, uint32_t n) { return roundDiv(total * i, n); }
+
+        // Integer hue (0 - 1535, six 256-wide sectors) to full saturation/value RGB components
+        constexpr uint8_t hueRed(uint16_t h) { return h < 256 ? 255 : h < 512 ? 511 - h : h < 1024 ? 0 : h < 1280 ? h - 1024 : 255; }
+        constexpr uint8_t hueGreen(uint16_t h) { return h < 256 ? h : h < 768 ? 255 : h < 1024 ? 1023 - h : 0; }
+        constexpr uint8_t hueBlue(uint16_t h) { return h < 512 ? 0 : h < 768 ? h - 512 : h < 1280 ? 255 : 1535 - h; }
+
+        // Packed 0xRRGGBB helpers
+        constexpr uint8_t red(uint32_t c) { return (uint8_t)(c >> 16); }
+        constexpr uint8_t green(uint32_t c) { return (uint8_t)(c >> 8); }
+        constexpr uint8_t blue(uint32_t c) { return (uint8_t)c; }
+        constexpr uint32_t pick(uint8_t, uint32_t only) { return only; }
+        template <typename... T>
+        constexpr uint32_t pick(uint8_t i, uint32_t first, T... rest) { return i == 0 ? first : pick(i - 1, rest...); }
+
+        // Frame table checks
+        template <class Gen>
+        constexpr bool increasing(uint8_t i)
+        {
+            return i + 1 >= Gen::frameCount || ((Gen::frame(i).time & FRAME_TIME_MASK) < (Gen::frame(i + 1).time & FRAME_TIME_MASK) && increasing<Gen>(i + 1));
+        }
+
+        template <class Gen, uint8_t... I>
+        constexpr frameTable<sizeof...(I)> build(indices<I...>) { return frameTable<sizeof...(I)>{{Gen::frame(I)...}}; }
+    } // namespace gen
+
+    // Builds a generator's frame table at compile time
+    template <class Gen>
+    constexpr frameTable<Gen::frameCount> generate()
+    {
+        static_assert(Gen::frameCount >= 2 && Gen::frameCount <= 20, "Animations need 2 to 20 frames");
+        static_assert((Gen::frame(0).time & FRAME_TIME_MASK) == 0, "First frame must start at 0");
+        static_assert((Gen::frame(Gen::frameCount - 1).time & FRAME_TIME_MASK) == Gen::time, "Last frame must be at the animation's runtime");
+        static_assert(gen::increasing<Gen>(0), "Frame times must be strictly increasing");
+        return gen::build<Gen>(typename gen::makeIndices<Gen::frameCount>::type());
+    }
+
+    // Base for generators with frames in RGB
+    struct rgbGenerator
+    {
+        static const uint8_t flags = 0;
+    };
+
+    // Base for generators with frames in HSV
+    struct hsvGenerator
+    {
+        static const uint8_t flags = HSV_FLAG;
+    };
+
+    // Constant color
+    template <uint8_t R, uint8_t G, uint8_t B, uint32_t TIME = 1000>
+    struct SolidColor : rgbGenerator
+    {
+        static const uint8_t frameCount = 2;
+        static const uint32_t time = TIME;
+        static constexpr animFrame frame(uint8_t i) { return animFrame{{R, G, B}, i ? TIME : 0}; }
+    };
+
+    // Fades from a color to black and back in STEPS segments (STEPS even), each with the given easing
+    template <uint8_t R, uint8_t G, uint8_t B, uint32_t TIME, uint8_t STEPS = 4, easing EASE = LINEAR>
+    struct Breathe : rgbGenerator
+    {
+        static_assert(STEPS % 2 == 0, "Breathe needs an even number of steps");
+        static const uint8_t frameCount = STEPS + 1;
+        static const uint32_t time = TIME;
+        static constexpr uint8_t level(uint8_t c, uint8_t i) { return gen::roundDiv((uint32_t)c * (i * 2 > STEPS ? i * 2 - STEPS : STEPS - i * 2), STEPS); }
+        static constexpr uint32_t frameTime(uint8_t i) { return i < STEPS ? easedTime(gen::stepTime(TIME, i, STEPS), EASE) : TIME; }
+        static constexpr animFrame frame(uint8_t i) { return animFrame{{level(R, i), level(G, i), level(B, i)}, frameTime(i)}; }
+    };
+
+    // Full hue sweep (red back to red) in STEPS segments blended in RGB
+    template <uint32_t TIME, uint8_t STEPS = 12>
+    struct Rainbow : rgbGenerator
+    {
+        static const uint8_t frameCount = STEPS + 1;
+        static const uint32_t time = TIME;
+        static constexpr uint16_t hue(uint8_t i) { return (uint16_t)(gen::stepTime(1536, i, STEPS) % 1536); }
+        static constexpr animFrame frame(uint8_t i) { return animFrame{{gen::hueRed(hue(i)), gen::hueGreen(hue(i)), gen::hueBlue(hue(i))}, gen::stepTime(TIME, i, STEPS)}; }
+    };
+
+    // Full hue sweep blended in HSV (2 frames, hue 0 -> 255), at a given saturation and value
+    template <uint32_t TIME, uint8_t SAT = 255, uint8_t VAL = 255>
+    struct HueSweep : hsvGenerator
+    {
+        static const uint8_t frameCount = 2;
+        static const uint32_t time = TIME;
+        static constexpr animFrame frame(uint8_t i) { return animFrame{{(uint8_t)(i ? 255 : 0), SAT, VAL}, i ? TIME : 0}; }
+    };
+
+    // Flashes a color for ON ms every PERIOD ms
+    template <uint8_t R, uint8_t G, uint8_t B, uint32_t PERIOD, uint32_t ON>
+    struct Strobe : rgbGenerator
+    {
+        static_assert(ON > 0 && ON + 1 < PERIOD, "Strobe on time must fit in the period");
+        static const uint8_t frameCount = 4;
+        static const uint32_t time = PERIOD;
+        static constexpr animFrame frame(uint8_t i)
+        {
+            return i < 2 ? animFrame{{R, G, B}, i ? ON : 0} : animFrame{{0, 0, 0}, i == 2 ? ON + 1 : PERIOD};
+        }
+    };
+
+    // Steps through a list of colors (packed 0xRRGGBB), holding each for an equal share of TIME
+    template <uint32_t TIME, uint32_t... COLORS>
+    struct ColorSteps : rgbGenerator
+    {
+        static const uint8_t count = sizeof...(COLORS);
+        static const uint8_t frameCount = count * 2;
+        static const uint32_t time = TIME;
+        static constexpr uint32_t color(uint8_t k) { return gen::pick(k, COLORS...); }
+        static constexpr uint32_t start(uint8_t k) { return gen::stepTime(TIME, k, count); }
+        static constexpr uint32_t end(uint8_t k) { return k + 1 == count ? TIME : start(k + 1) - 1; }
+        static constexpr animFrame frame(uint8_t i)
+        {
+            return animFrame{{gen::red(color(i / 2)), gen::green(color(i / 2)), gen::blue(color(i / 2))}, i % 2 ? end(i / 2) : start(i / 2)};
+        }
+    };
+} // namespace AnimationDriver
+
+// Declares an exactly-sized animation in flash from a generator type
+#define GENERATED_ANIMATION(name, ...)                                                                               \
+    const AnimationDriver::frameTable<__VA_ARGS__::frameCount> name##_Frames PROGMEM = AnimationDriver::generate<__VA_ARGS__>(); \
+    const AnimationDriver::flashAnimation name PROGMEM = {name##_Frames.frames, __VA_ARGS__::frameCount | __VA_ARGS__::flags, __VA_ARGS__::time}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef EVENT_QUEUE
+#define EVENT_QUEUE
+
+#include <stdint.h>
+
+// Keeps the compiler from moving memory accesses across it (a single core needs nothing more)
+#define EVENT_QUEUE_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * Fixed-size single-producer/single-consumer event ring, safe between an interrupt and the main loop
+ * Each index is a single byte written by one side only, so neither side ever has to mask interrupts: the
+ *  producer fills a slot before publishing it, and the consumer copies a slot out before releasing it.
+ * One side must be one context: ISRs do not nest on AVR, so all interrupt handlers together count as one
+ *  producer, except ones made interruptible (ISR_NOBLOCK) that another producer can preempt. Several producers
+ *  can share it by pushing with interrupts masked.
+ * @param Event copyable event type
+ * @param Size slots, a power of 2 up to 128
+ */
+template <class Event, uint8_t Size>
+class EventQueueT
+{
+    static_assert(Size && !(Size & (Size - 1)) && Size <= 128, "Event queue size must be a power of 2 up to 128");
+
+private:
+    Event _events[Size];
+    volatile uint8_t _head; // Events posted (free-running, written by the producer only)
+    volatile uint8_t _tail; // Events taken (free-running, written by the consumer only)
+    volatile uint8_t _lost; // Events dropped because the queue was full
+
+public:
+    EventQueueT() : _head(0), _tail(0), _lost(0) {}
+
+    // Posts an event (producer side), false if the queue is full
+    bool push(const Event &event)
+    {
+        uint8_t head = _head;
+        if ((uint8_t)(head - _tail) == Size)
+        {
+            if (_lost != 0xFF)
+            {
+                _lost++;
+            }
+            return false;
+        }
+        _events[head & (Size - 1)] = event;
+        EVENT_QUEUE_BARRIER();
+        _head = head + 1;
+        return true;
+    }
+
+    // Takes the oldest event (consumer side), false if there is none
+    bool pop(Event &event)
+    {
+        uint8_t tail = _tail;
+        if (tail == _head)
+        {
+            return false;
+        }
+        event = _events[tail & (Size - 1)];
+        EVENT_QUEUE_BARRIER();
+        _tail = tail + 1;
+        return true;
+    }
+
+    bool empty() const { return _tail == _head; }
+    uint8_t lost() const { return _lost; } // Events dropped so far (saturates at 255)
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef FRAME_CLOCK
+#define FRAME_CLOCK
+
+#include <stdint.h>
+
+/**
+ * Fixed-rate render clock, parameterized on a clock policy providing "unsigned long now()" in ms
+ * Ticks are scheduled from the previous tick rather than from when the caller got round to checking, so the
+ *  frame rate holds regardless of how long each pass of the main loop takes. Periods that are not a whole
+ *  number of ms (e.g. 60 fps) are spread out so the rate does not drift.
+ * Ticks the caller was too late for are skipped and counted as dropped, never rendered in a burst.
+ */
+template <class Clock>
+class FrameClockT : private Clock
+{
+private:
+    uint16_t _fps;
+    uint16_t _period;    // Whole ms per frame
+    uint16_t _remainder; // Leftover ms per frame, in 1/fps steps
+    uint16_t _error;     // Accumulated leftover
+    unsigned long _next; // System time of the next tick
+    unsigned long _frames;
+    unsigned long _dropped;
+
+    // Moves the next tick on by one period
+    void advance()
+    {
+        _next += _period;
+        _error += _remainder;
+        if (_error >= _fps)
+        {
+            _error -= _fps;
+            _next++;
+        }
+    }
+
+public:
+    /**
+     * @param fps frame rate (1 - 1000)
+     * @param clock policy instance (only needed for stateful policies)
+     */
+    FrameClockT(uint16_t fps, const Clock &clock = Clock()) : Clock(clock) { setRate(fps); }
+
+    // Changes the frame rate, taking effect from the next tick
+    void setRate(uint16_t fps)
+    {
+        _fps = fps ? fps : 1;
+        _period = 1000 / _fps;
+        _remainder = 1000 % _fps;
+        _error = 0;
+    }
+
+    // Starts ticking from now, clearing the counters
+    void start()
+    {
+        _next = Clock::now();
+        _frames = 0;
+        _dropped = 0;
+    }
+
+    // Whether a frame is due (consumes the tick)
+    bool due()
+    {
+        unsigned long now = Clock::now();
+        if ((long)(now - _next) < 0)
+        {
+            return false;
+        }
+        advance();
+        // Skip any ticks that passed while the loop was busy
+        while ((long)(now - _next) >= 0)
+        {
+            advance();
+            _dropped++;
+        }
+        _frames++;
+        return true;
+    }
+
+    uint16_t fps() { return _fps; }
+    unsigned long frames() { return _frames; }   // Frames rendered since start()
+    unsigned long dropped() { return _dropped; } // Ticks skipped since start()
+};
+
+#endif
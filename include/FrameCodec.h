@@ -0,0 +1,16 @@
+#ifndef FRAME_CODEC
+#define FRAME_CODEC
+
+#include <stdint.h>
+#include <AnimationDriver.h>
+
+// Bytes per frame on the serial link: r, g, b, then the frame time (4 bytes, big-endian, easing bits included)
+//  Programs (SCRIPT_FLAG) travel as stored, in blocks of the same size
+#define FRAME_SIZE 7
+
+// Fills an animation from its frame count and serial frames
+void decodeAnimation(uint8_t frameCount, const uint8_t *frames, AnimationDriver::animation &anim);
+// Writes an animation's frames in serial form, returns the bytes written
+uint16_t encodeFrames(const AnimationDriver::animation &anim, uint8_t *frames);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef HAPTIC_ENGINE
+#define HAPTIC_ENGINE
+
+#include <stdint.h>
+
+// One step of a haptic pattern: the drive level ramps linearly from "from" to "to" over "time" ms
+struct hapticStep
+{
+    uint8_t from; // Drive level at the start of the step (0 - 255)
+    uint8_t to;   // Drive level at the end of the step
+    uint8_t time; // Step length in ms (0 ends the pattern)
+};
+
+/**
+ * Plays haptic patterns (stored in PROGMEM) on the motor pin from a timer interrupt
+ * On AVR, Timer2 runs in fast PWM with a 1 ms period: the overflow interrupt advances the pattern and raises
+ *  the pin, the compare interrupt drops it, so the motor gets software PWM on any pin and pulse timing does not
+ *  depend on how long loop() takes. Timer2 (tone(), PWM on pins 3 and 11) must be free.
+ * On other targets tick() has to be called every ms by the caller.
+ * An optional callback is run when a pattern plays to its end, only ever from tick() (the timer interrupt on AVR,
+ *  so it must be short and interrupt safe); stopping a pattern does not run it.
+ */
+class HapticEngine
+{
+private:
+    uint8_t _pin;
+    const hapticStep *volatile _step; // Current step (in flash), null when idle
+    volatile uint8_t _elapsed;        // Time spent in the current step
+    volatile uint8_t _level;          // Current drive level
+    void (*_done)();                  // Run when a pattern ends
+    void output(uint8_t level);
+
+public:
+    void begin(uint8_t pin, void (*done)() = 0);
+    void play(const hapticStep *pattern); // Start a pattern, replacing any pattern playing
+    void stop();
+    bool isPlaying();
+    void tick();  // Advance the pattern by one ms (called from the timer interrupt on AVR)
+    void pulse(); // End of the on time of a PWM period (called from the timer interrupt on AVR)
+};
+
+extern HapticEngine Haptics;
+
+#endif
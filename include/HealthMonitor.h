@@ -0,0 +1,80 @@
+#ifndef HEALTH_MONITOR
+#define HEALTH_MONITOR
+
+#include <stdint.h>
+
+// Reset causes (as in MCUSR)
+#define HEALTH_RESET_POWER 0x01
+#define HEALTH_RESET_EXTERNAL 0x02
+#define HEALTH_RESET_BROWNOUT 0x04
+#define HEALTH_RESET_WATCHDOG 0x08
+
+// Time between stack scans
+#ifndef HEALTH_CHECK_MS
+#define HEALTH_CHECK_MS 1000
+#endif
+
+/**
+ * RAM and main loop health, kept across resets
+ * On AVR:
+ *  - RAM from the end of the static data to the top of the stack is painted before the C runtime starts, so the
+ *    deepest the stack has reached is the first byte above the heap that still holds the paint. check() scans for
+ *    it and keeps the smallest gap seen between the heap (String and anything else using malloc()) and the stack.
+ *  - The watchdog (2 s) runs in interrupt mode: a loop() that goes that long without pet() is counted from the
+ *    interrupt, without a reset. With reset enabled (needs a bootloader that turns the watchdog off, e.g.
+ *    optiboot, the old Nano bootloader loops forever) the next timeout resets the lamp, counted on the way back up.
+ *  - The reset cause is read from MCUSR. Optiboot clears it and passes it on in r2, which is only trusted when
+ *    built with -DHEALTH_OPTIBOOT (env nanoatmega328new) and not after softReset().
+ * Counts that have to survive a reset are carried in .noinit RAM and folded into an EEPROM record by begin() and
+ *  check(), with the lowest free RAM ever seen. Passes (time between pet() calls) over budget are counted on every
+ *  target; the memory figures are 0 off AVR.
+ */
+class HealthMonitor
+{
+public:
+    // Record kept in EEPROM
+    struct record
+    {
+        uint16_t wdtResets;   // Resets by the watchdog
+        uint16_t wdtOverruns; // Watchdog timeouts (loop stuck)
+        uint16_t freeMin;     // Lowest free RAM between heap and stack (0xFFFF until measured)
+    };
+
+private:
+    int _addr;                       // EEPROM address of the record
+    unsigned long _budget;           // Longest expected pass (us)
+    volatile unsigned long _lastPet; // Time of the last pet() (us)
+    unsigned long _passMax;          // Longest pass since startup (us)
+    uint16_t _overruns;              // Passes over budget since startup
+    uint16_t _freeMin;               // Lowest free RAM since startup
+    unsigned long _lastCheck;        // Time of the last stack scan (ms)
+    record _log;                     // Copy of the EEPROM record
+    void fold();
+
+public:
+    /**
+     * Reads the reset cause, updates the EEPROM record and starts the watchdog
+     * @param addr EEPROM address of the record (6 bytes)
+     * @param budgetMs passes longer than this are counted as overruns
+     * @param reset let a second watchdog timeout reset the lamp
+     */
+    void begin(int addr, uint16_t budgetMs, bool reset);
+    void pet();      // Once per pass of loop(), and from bounded waits that can outlast the watchdog
+    void check();    // From loop(): scans the stack every HEALTH_CHECK_MS, saves new lows and timeouts to EEPROM
+    void watchdog(); // Watchdog timeout (called from the watchdog interrupt on AVR)
+
+    void softReset();                            // Restarts from the reset vector, reported as a software reset (returns off AVR)
+
+    uint8_t resetCause();                        // HEALTH_RESET_ flags of the last reset (0 for a jump to the reset vector)
+    uint16_t stackUsed();                        // Deepest the stack has reached
+    uint16_t heapUsed();                         // Heap grown by malloc()
+    uint16_t freeNow();                          // RAM between the heap and the stack pointer
+    uint16_t freeMin() { return _freeMin; }      // Lowest free RAM between the heap and the deepest stack since startup
+    unsigned long passMax() { return _passMax; } // Longest pass (us)
+    uint16_t overruns() { return _overruns; }    // Passes over budget since startup
+    const record &log() { return _log; }
+};
+
+extern HealthMonitor Health;
+
+#endif
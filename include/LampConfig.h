@@ -0,0 +1,93 @@
+/**
+ * VroomLamp/LampConfig.h
+ *
+ * Hardware definitions and tuning constants shared by the firmware and the native benchmarks.
+ *  Tuning values are guarded so they can be overridden from build_flags (e.g. -DT_SETTLE=100).
+ */
+#ifndef LAMP_CONFIG
+#define LAMP_CONFIG
+
+// Hardware defs
+#define POT_PIN A6
+#define STICK_PIN_1 A7
+#define STICK_PIN_2 A5
+#define MOTOR_PIN 4
+#define PIXEL_PIN A2
+
+#define NUM_LEDS 4
+
+// Numerical Constants
+// #define T_LOOP 0     // Execution loop time
+#ifndef T_MOTOR
+#define T_MOTOR 200 // Longest time the motor runs after a stick shift (haptic patterns end on their own)
+#endif
+#ifndef T_SETTLE
+#define T_SETTLE 150 // Settle time for stick position change
+#endif
+#ifndef POT_THRES
+#define POT_THRES 10 // Threshold to read new pot values
+#endif
+#ifndef MOVE_THRES
+#define MOVE_THRES 40
+#endif
+#ifndef MOVE_GAIN
+#define MOVE_GAIN 3
+#endif
+#ifndef T_MOVE_LOOP
+#define T_MOVE_LOOP 30
+#endif
+#ifndef FILTER_BUFF
+#define FILTER_BUFF 20
+#endif
+#ifndef T_FADE
+#define T_FADE 250 // Crossfade time between animations on a shift
+#endif
+#ifndef RENDER_FPS
+#define RENDER_FPS 60 // Rate frames are rendered and pushed to the strip
+#endif
+#ifndef SYNC_PERIOD
+#define SYNC_PERIOD 1000 // Time between sync beacons sent by the sync master
+#endif
+#ifndef SYNC_STEP_MS
+#define SYNC_STEP_MS 100 // Sync error that steps the clock rather than slewing it
+#endif
+#ifndef LOOP_BUDGET_MS
+#define LOOP_BUDGET_MS 20 // Longest expected pass of loop(), longer ones are counted as overruns
+#endif
+#define GEAR_COUNT 6
+
+// EEPROM layout: GEAR_COUNT user animation slots, followed by the gear map
+//  Gear map entries hold the slot each gear plays: a user slot index, or BUILTIN_SLOT | index of a built-in animation
+#define GEAR_MAP_ADDR (GEAR_COUNT * sizeof(AnimationDriver::animation))
+#define BUILTIN_SLOT 0x80
+// Sync role after the gear map (SYNC_MASTER_ROLE sends beacons, anything else follows them)
+#define SYNC_ROLE_ADDR (GEAR_MAP_ADDR + GEAR_COUNT)
+#define SYNC_MASTER_ROLE 0x01
+// Health record after the sync role (watchdog counts and lowest free RAM, see HealthMonitor.h)
+#define HEALTH_ADDR (SYNC_ROLE_ADDR + 1)
+
+// Stick calibration (filtered sensor readings at each gear)
+#define STICK_THRES 30
+// R
+#define GR_1 64
+#define GR_2 10
+// 1
+#define G1_1 271
+#define G1_2 25
+// 2
+#define G2_1 114
+#define G2_2 10
+// 3
+#define G3_1 78
+#define G3_2 98
+// 4
+#define G4_1 99
+#define G4_2 110
+// 5
+#define G5_1 26
+#define G5_2 402
+// 6
+#define G6_1 18
+#define G6_2 126
+
+#endif
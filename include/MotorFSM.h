@@ -1,18 +1,24 @@
+#ifndef MOTOR_FSM
+#define MOTOR_FSM
+
 #include <stdint.h>
+#include <Trace.h>
 
 // Typedef for functions to turn on/off and initialize hardware
 typedef void (*triggerFunc)();
 typedef void (*shutoffFunc)();
 typedef void (*initFunc)();
 typedef unsigned long (*sysTimeFunc)();
-class MotorFSM
+
+/**
+ * Motor state machine parameterized on a hardware policy, so the hardware calls can be inlined
+ * The policy provides: void setup(), void on(), void off(), unsigned long now()
+ *  (static or member functions, an empty policy costs no RAM)
+ */
+template <class Hardware>
+class MotorFSMT : private Hardware
 {
 private:
-    triggerFunc _trigger;
-    shutoffFunc _shutoff;
-    initFunc _init;
-    sysTimeFunc _getSysTime;
-
     unsigned long _runtime;
     enum states
     {
@@ -23,10 +29,81 @@ private:
     states currentState;
     unsigned long _timer;
 
+public:
+    /**
+     * @param runtime the length of time the motor should run for
+     * @param hardware policy instance (only needed for stateful policies)
+     */
+    MotorFSMT(unsigned long runtime, const Hardware &hardware = Hardware()) : Hardware(hardware), _runtime(runtime) {}
+
+    // Initializes the motor pin to output
+    void init()
+    {
+        Hardware::setup();
+        Hardware::off();
+        currentState = IDLE;
+    }
+
+    void run()
+    {
+        switch (currentState)
+        {
+        case TRIGGERED:
+            TRACE(TRACE_INFO, TR_MOTOR_ON, _runtime, 0);
+            // Reset timer
+            _timer = Hardware::now();
+            // Turn on motor pin
+            Hardware::on();
+            // Write new state
+            currentState = RUNNING;
+            break;
+        case RUNNING:
+            // Check runtime
+            if (Hardware::now() - _timer > _runtime) // If motor has been on for runtime
+            {
+                TRACE(TRACE_INFO, TR_MOTOR_OFF, 0, 0);
+                // Turn off motor
+                Hardware::off();
+                // Update State
+                currentState = IDLE;
+            }
+            break;
+        case IDLE:
+            // Do nothing
+            break;
+        }
+    }
+
+    // Used to trigger the motor
+    void trigger() { currentState = TRIGGERED; }
+
+    // Check if the motor is running;
+    bool isRunning() { return currentState == RUNNING; }
+};
+
+// Hardware policy that calls through function pointers (used by MotorFSM)
+class MotorFuncPolicy
+{
+private:
+    triggerFunc _trigger;
+    shutoffFunc _shutoff;
+    initFunc _init;
+    sysTimeFunc _getSysTime;
+
+public:
+    MotorFuncPolicy(triggerFunc trigger, shutoffFunc shutoff, initFunc init, sysTimeFunc getSysTime)
+        : _trigger(trigger), _shutoff(shutoff), _init(init), _getSysTime(getSysTime) {}
+    void setup() { _init(); }
+    void on() { _trigger(); }
+    void off() { _shutoff(); }
+    unsigned long now() { return _getSysTime(); }
+};
+
+// Function pointer based motor FSM, kept for compatibility with other projects
+class MotorFSM : public MotorFSMT<MotorFuncPolicy>
+{
 public:
     MotorFSM(triggerFunc, shutoffFunc, initFunc, sysTimeFunc, unsigned long);
-    void init();
-    void run();
-    void trigger();
-    bool isRunning();
 };
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SCRIPT_VM
+#define SCRIPT_VM
+
+#include <stdint.h>
+#include <AnimationDriver.h>
+
+// Program bytes are uploaded in blocks the size of a serial frame
+#define SCRIPT_BLOCK_SIZE 7
+// Instructions run per update before yielding (bounds programs that never wait)
+#define SCRIPT_MAX_STEPS 32
+// Linear fades approximating an eased or HSV keyframe segment
+#define SCRIPT_CURVE_PARTS 8
+
+namespace AnimationDriver
+{
+    /**
+     * Bytecode for procedural animations (times are big-endian ms, masks have a bit per pixel)
+     * Running past the last byte restarts the program, like END.
+     *  END                     restart from the top
+     *  SET r g b               set the color
+     *  FADE r g b tH tL        fade from the current color to r g b over t ms
+     *  WAIT tH tL              hold for t ms
+     *  LOOP n                  repeat up to the matching NEXT n times (0 repeats forever), nests 2 deep (deeper ends the program)
+     *  NEXT
+     *  RHUE s v                set a random hue at saturation s and value v
+     *  RFADE s v tH tL         fade to a random hue at saturation s and value v over t ms
+     *  RWAIT tH tL             hold for a random 0 - t ms
+     *  MASK m                  light only the pixels in m (the rest are off)
+     *  ROTATE                  rotate the mask by one pixel (chase)
+     *  RMASK                   random mask (sparkle)
+     * Keyframe animations compile to SET to the first frame, then a FADE (or WAIT and SET for STEP easing) per
+     *  segment, or several fades through points of the curve for eased and HSV segments, see compileKeyframes().
+     */
+    enum opcode : uint8_t
+    {
+        OP_END,
+        OP_SET,
+        OP_FADE,
+        OP_WAIT,
+        OP_LOOP,
+        OP_NEXT,
+        OP_RHUE,
+        OP_RFADE,
+        OP_RWAIT,
+        OP_MASK,
+        OP_ROTATE,
+        OP_RMASK,
+    };
+
+    /**
+     * Converts a keyframe animation into a program, colors worked out as the animation driver does
+     *  Linear RGB and STEP segments match exactly. Linear HSV segments fade to each hue sector edge they cross,
+     *  which matches while saturation and value hold. Eased segments are approximated with SCRIPT_CURVE_PARTS
+     *  fades along the curve (a few counts off, e.g. up to 4 for SINE).
+     * @return program length in bytes, 0 if the program does not fit
+     */
+    uint8_t compileKeyframes(const animation &anim, uint8_t *program, uint8_t size);
+
+    /**
+     * Interpreter for animation programs, with system time passed in by the caller
+     * The program is run in place (e.g. from an animation buffer loaded from EEPROM); the VM itself only holds
+     *  the program counter, the loop stack, the current fade and the output.
+     * Timed instructions start when the previous one ended rather than when the VM got round to them, so
+     *  loops keep their rate however often update() is called.
+     */
+    class ScriptCore
+    {
+    private:
+        const uint8_t *program;
+        uint8_t length;
+        uint8_t pc;                // Next instruction
+        uint8_t loopStart[2];      // Loop stack: instruction after LOOP
+        uint8_t loopCount[2];      //  and repeats left (0 forever)
+        uint8_t depth;             // Loops open
+        bool waiting;              // A timed instruction is running
+        bool fading;               //  and it is a fade
+        unsigned long opStart;     // System time the running instruction started
+        uint16_t opTime;           // Length of the running instruction
+        uint8_t from[3], to[3];    // Fade end points
+        uint8_t color[3];          // Current color
+        uint8_t pixels;            // Pixels the mask covers (up to 8)
+        uint8_t mask;              // Lit pixels
+        uint16_t seed;             // Random state
+        bool dirty;                // The output must be returned even if unchanged
+        uint8_t shown[4];          // Color and mask last returned by update()
+        uint16_t random();
+        uint16_t readTime(uint8_t); // Big-endian ms at an offset from pc
+        void randomHue(uint8_t, uint8_t, uint8_t *);
+        void startTimed(uint16_t, bool);
+        void step();                // Executes one instruction
+
+    public:
+        ScriptCore(uint8_t pixels = 8);
+        void load(const uint8_t *, uint8_t, unsigned long); // Run a program (must stay valid while running)
+        void restart(unsigned long);                        // Start the program from the top
+        const uint8_t *render(unsigned long);               // Runs the program up to a system time and returns the color state (r, g, b)
+        const uint8_t *update(unsigned long);               // As render(), but returns null when the output has not changed since the last update()
+        uint8_t getMask();                                  // Pixels lit by the color (bit per pixel)
+        void redraw();                                      // Makes the next update() return the color even if unchanged
+    };
+
+    // Script driver reading time from a clock policy providing a static "unsigned long now()"
+    template <class Clock>
+    class ScriptDriverT : public ScriptCore
+    {
+    public:
+        ScriptDriverT(uint8_t pixels = 8) : ScriptCore(pixels) {}
+        void load(const uint8_t *program, uint8_t length) { ScriptCore::load(program, length, Clock::now()); }
+        void restart() { ScriptCore::restart(Clock::now()); }
+
+        // Runs the program and passes the output to a callable taking (uint8_t r, uint8_t g, uint8_t b, uint8_t mask)
+        //  The callable is skipped when the output has not changed
+        template <class Drive>
+        void run(Drive runLEDs)
+        {
+            const uint8_t *c = update(Clock::now());
+            if (c)
+            {
+                runLEDs(c[0], c[1], c[2], getMask());
+            }
+        }
+    };
+} // namespace AnimationDriver
+
+#endif
@@ -1,7 +1,11 @@
+#ifndef SHIFTER_FSM
+#define SHIFTER_FSM
+
 // Typedef for system time function
 typedef unsigned long (*sysTimeFunc)();
 
-class ShifterFSM
+// Shifter state machine logic, with time passed in by the caller
+class ShifterFSMCore
 {
 
 public:
@@ -16,10 +20,13 @@ public:
         SIX,
         NEUTRAL
     }; // lighting modes
-    ShifterFSM(sysTimeFunc, unsigned long);
-    mode init(int);      // Initialize the shifter with a value
-    mode run(int, bool); // FSM loop to run controller
-    bool getFlag();
+    ShifterFSMCore(unsigned long);
+    mode init(int);                     // Initialize the shifter with a value
+    mode run(int, bool, unsigned long); // FSM loop to run controller at a given system time
+    mode getIntent();                   // Mode the stick is settling into (NEUTRAL when no change is pending)
+
+protected:
+    bool getFlag(); // Whether the stick settled into a gear since the last call
 
 private:
     enum states
@@ -32,8 +39,42 @@ private:
     states currentState;                     // Current state of the controller
     mode getStickMode(int);                  // Get map passed value to stick mode
     mode activeMode, intentMode, polledMode; // Current Mode of system, the potential next mode, mode represented by the last sensor read
-    sysTimeFunc _getSysTime;                 // Reference to parent scope function to read system time
     unsigned long _timer;                    // Timer used to track settling time
     unsigned long _tSettle;                  // Settle time for stick changes
     bool updateFlag = false;                 // Flag to check if the mode was recently changed
 };
+
+/**
+ * Shifter FSM parameterized on a policy, so its calls can be inlined
+ * The policy provides: unsigned long now(), and void settled(mode) run from run() when the stick settles into a
+ *  gear (static functions)
+ */
+template <class Policy>
+class ShifterFSMT : public ShifterFSMCore
+{
+public:
+    ShifterFSMT(unsigned long tSettle) : ShifterFSMCore(tSettle) {}
+    mode run(int val, bool isMoving)
+    {
+        mode active = ShifterFSMCore::run(val, isMoving, Policy::now());
+        if (getFlag())
+        {
+            Policy::settled(active);
+        }
+        return active;
+    }
+};
+
+// Function pointer based shifter FSM, kept for compatibility with other projects
+class ShifterFSM : public ShifterFSMCore
+{
+public:
+    ShifterFSM(sysTimeFunc, unsigned long);
+    mode run(int, bool); // FSM loop to run controller
+    using ShifterFSMCore::getFlag;
+
+private:
+    sysTimeFunc _getSysTime; // Reference to parent scope function to read system time
+};
+
+#endif
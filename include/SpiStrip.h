@@ -0,0 +1,54 @@
+#ifndef SPI_STRIP
+#define SPI_STRIP
+
+#include <stdint.h>
+
+// SPI bytes per pixel (24 WS2812 bits, 2 per byte)
+#define SPI_STRIP_PIXEL_BYTES 12
+
+/**
+ * WS2812 output through the hardware SPI port (data on MOSI, D11) fed from an interrupt, so frames go out
+ *  without turning interrupts off (Adafruit_NeoPixel::show() masks them for ~30 us per LED, dropping serial
+ *  bytes and millis() ticks). USART0 is taken by the serial port (UartSerial), so the SPI port is used rather than USART in SPI mode.
+ * SPI runs at 2 MHz; each WS2812 bit is sent as 3 SPI bits (100 for 0, 110 for 1) and each byte carries two of
+ *  them followed by two low bits. The line stays low between bytes until the SPI interrupt loads the next one, and
+ *  a long enough low phase latches the strip mid-frame. Worst case, estimated from instruction counts (not measured
+ *  on hardware): 2 us from the encoding (a 0 bit then the two low bits), about 3 us for the SPI interrupt to get to
+ *  SPDR, plus whatever interrupts it has to wait behind: millis() (Timer0, about 5 us) and UartSerial (about 4 us
+ *  per byte). The haptic tick and the watchdog interrupt let the SPI interrupt in (ISR_NOBLOCK). That makes about
+ *  14 us: fine for parts latching after 50 us or more (WS2812B datasheet, 280 us for WS2812B-V5 and WS2813), but
+ *  some WS2812 parts latch after 6 - 9 us of low and can glitch. Use the NeoPixel backend with those.
+ * The strip shows one color (as the animation drivers output), so a single pixel is pre-encoded (with
+ *  brightness already applied, in GRB order) and repeated for every LED lit by the mask (bit per pixel,
+ *  repeating every 8 pixels), the others are sent black. write() encodes into a back buffer
+ *  and returns straight away; the frame starts once the previous one has gone out and latched.
+ * On other targets (native builds) write() does no output.
+ */
+class SpiStrip
+{
+private:
+    uint16_t _count;
+    uint8_t _brightness;
+    uint8_t _buffers[2][SPI_STRIP_PIXEL_BYTES]; // Encoded pixel: front being sent, back waiting
+    uint8_t _masks[2]; // Lit pixels of each buffer
+    uint8_t _front;
+    volatile bool _busy;
+    volatile bool _pending;       // Back buffer holds a frame that has not been sent
+    volatile uint8_t _index;      // Next byte of the encoded pixel
+    volatile uint8_t _byte;       // That byte, worked out ahead so the interrupt can send it straight away
+    volatile uint16_t _remaining; // Pixels left to send, including the current one
+    volatile unsigned long _end;  // micros() when the last frame finished
+    uint8_t byteAt();
+
+public:
+    void begin(uint16_t count);
+    void setBrightness(uint8_t brightness);
+    void write(uint8_t r, uint8_t g, uint8_t b, uint8_t mask = 0xFF); // Queue a color for the lit pixels, never waits
+    void poll();                                                      // Starts a queued frame once the strip has latched
+    bool isBusy();
+    void next(); // Feeds the next byte (called from the SPI interrupt on AVR)
+};
+
+extern SpiStrip StripSPI;
+
+#endif
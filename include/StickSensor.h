@@ -0,0 +1,28 @@
+#ifndef STICK_SENSOR
+#define STICK_SENSOR
+
+#include <stdint.h>
+
+/**
+ * Stick light sensor readings: a running average per sensor, and the gear a pair of averages maps to
+ *  (calibration in LampConfig.h)
+ */
+class StickFilter
+{
+private:
+    uint8_t _pin;
+    unsigned long _sum;
+    unsigned long _count; // Samples in the sum, restarted after FILTER_BUFF
+
+public:
+    StickFilter(uint8_t pin) : _pin(pin), _sum(0), _count(0) {}
+    int update(int sample); // Adds a sample and returns the average
+    int average() { return _sum / _count; }
+    int read(bool hold) { return hold ? average() : update(sample()); } // Samples the sensor unless held, returns the average
+    int sample();                                                        // Reads the sensor
+};
+
+// Gear (0 - 6 for R - 6, 7 for neutral) of a pair of filtered stick readings
+int getStickPos(int stick1, int stick2);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SYNC_CLOCK
+#define SYNC_CLOCK
+
+#include <stdint.h>
+
+// Beacon on the wire: start byte (no request code uses it), shared time (4 bytes, big-endian), CRC-8 of the time
+#define SYNC_BEACON_START 0xA5
+#define SYNC_BEACON_SIZE 6
+// Longest wait for the rest of a beacon after its start byte (it takes 0.5 ms at 115200 baud)
+#define SYNC_BEACON_WAIT_MS 10
+
+/**
+ * Shared animation timebase for lamps running side by side
+ * One lamp (or the host) broadcasts beacons carrying its time; the others discipline a clock to it from their
+ *  own millis(). Each beacon is compared with the local estimate: large errors step the clock, small ones are
+ *  slewed out (half the error per beacon). The rate is measured apart from that, over the raw beacon times since
+ *  an anchor beacon (up to 10 minutes back), into a drift estimate (ppm), so between beacons the clock keeps
+ *  tracking the sender.
+ * A beacon that would step the clock is only acted on once a second one agrees with it (to within SYNC_STEP_MS),
+ *  so a single bad beacon cannot throw the clock out.
+ * Slews never run the clock backwards; steps do, and are reported by stepped() so animations can re-align.
+ * Until the first beacon the shared time is the local time.
+ */
+class SyncClock
+{
+private:
+    bool _locked;
+    bool _stepped;
+    unsigned long _localBase;  // Local time of the last correction
+    unsigned long _sharedBase; // Shared time at _localBase
+    unsigned long _last;       // Last shared time returned (kept monotonic)
+    int16_t _drift;            // Rate of the sender relative to the local clock (ppm)
+    long _error;               // Error measured at the last beacon (ms)
+    bool _stepPending;         // A beacon asked for a step that has not been confirmed
+    unsigned long _stepOffset; // Shared - local time it asked for
+    unsigned long _anchorLocal;  // Local time of the beacon the drift is measured from
+    unsigned long _anchorShared; // Shared time it carried
+    unsigned long estimate(unsigned long local);
+
+public:
+    SyncClock();
+    unsigned long now(unsigned long local);           // Shared time at a local time
+    void beacon(unsigned long shared, unsigned long local); // Disciplines the clock with a beacon received at a local time
+    bool isLocked() { return _locked; }
+    bool stepped();                                   // Whether the clock stepped since the last call
+    int16_t drift() { return _drift; }
+    long lastError() { return _error; }
+
+    static void encode(unsigned long shared, uint8_t *beacon);        // Fills SYNC_BEACON_SIZE bytes
+    static bool decode(const uint8_t *beacon, unsigned long &shared); // Whether the bytes are a valid beacon
+};
+
+extern SyncClock LampSync;
+
+#endif
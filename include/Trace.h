@@ -0,0 +1,103 @@
+#ifndef LAMP_TRACE
+#define LAMP_TRACE
+
+#include <stdint.h>
+
+/**
+ * Binary trace: compact records (event id, micros() timestamp, two 16 bit args) kept in a RAM ring
+ * Recording a record is a handful of stores with interrupts briefly masked, so tracing can stay on while
+ *  chasing timing bugs that Serial.print() would hide. The ring keeps the newest TRACE_DEPTH records (older
+ *  ones are counted as lost) until it is drained: all at once on request ("t-" over serial), or one record
+ *  per pass in the background with TRACE_STREAM (capture sessions only, it shares the line with the app).
+ * Records more detailed than TRACE_LEVEL compile to nothing, arguments included; set it with build_flags
+ *  (e.g. -DTRACE_LEVEL=TRACE_DEBUG). The default, TRACE_OFF, takes no RAM.
+ *
+ * Wire format (big-endian): 'T', record count, records lost (2 bytes), then 9 bytes per record:
+ *  id, a (2), b (2), time in us (4). tools/trace decodes captures into timelines.
+ */
+#define TRACE_OFF 0
+#define TRACE_ERROR 1 // Failures (ack timeouts, lost events, loop overruns)
+#define TRACE_INFO 2  // State changes (shifts, motor, loads, serial requests)
+#define TRACE_DEBUG 3 // Per-pass detail (FSM steps, frames, colors, stick readings)
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_OFF
+#endif
+#ifndef TRACE_DEPTH
+#define TRACE_DEPTH 24 // Records held (9 bytes each)
+#endif
+
+#define TRACE_RECORD_SIZE 9
+
+// Trace record ids (tools/trace/TraceDecode.cpp names and formats them, keep the two in step)
+enum traceId : uint8_t
+{
+    TR_BOOT,          // setup() finished (a: gear, b: sync role)
+    TR_SHIFT_MOVING,  // Stick started moving (a: gear it left)
+    TR_SHIFT_ARMED,   // Stick came to rest away from the active gear (a: gear it is in)
+    TR_SHIFT_SETTLED, // Settle time passed (a: gear read, b: gear it armed on)
+    TR_SHIFT_UPDATE,  // New gear active (a: gear)
+    TR_MOTOR_ON,      // Motor started (a: longest runtime ms)
+    TR_MOTOR_OFF,     // Motor runtime over
+    TR_ANIM_FRAME,    // Animation moved to a segment (a: frame index, b: ms into the period)
+    TR_ANIM_SKIP,     // Whole animation periods skipped (a: periods, b: period ms)
+    TR_ANIM_COLOR,    // Rendered color (a: r << 8 | g, b: b)
+    TR_EVENT,         // Event handled (a: type, b: arg)
+    TR_EVENT_LOST,    // Event queue full (a: type, b: arg)
+    TR_LOAD,          // Gear animation loaded (a: gear index, b: slot)
+    TR_SERIAL,        // Serial request (a: code character)
+    TR_ACK_FAIL,      // Serial acknowledge missing (a: byte received, 0xFFFF on timeout)
+    TR_STICKS,        // Filtered stick readings (a: stick 1, b: stick 2)
+    TR_OVERRUN,       // Loop pass over budget (a: ms since the last pet, b: 1 if the watchdog caught it)
+    TR_COUNT
+};
+
+#if TRACE_LEVEL
+struct traceRecord
+{
+    uint32_t time;
+    uint16_t a;
+    uint16_t b;
+    uint8_t id;
+};
+
+// Ring of the newest records, written from any context (main loop or interrupts)
+class TraceBuffer
+{
+private:
+    traceRecord _records[TRACE_DEPTH];
+    uint8_t _head;  // Next record written
+    uint8_t _count; // Records held
+    uint16_t _lost; // Records overwritten before being drained (saturates)
+    bool pop(traceRecord &);
+    uint16_t takeLost();
+
+public:
+    void record(uint8_t id, uint16_t a, uint16_t b);
+    void dump();   // Writes every held record as one block and empties the ring
+    void stream(); // Writes the oldest record as a block of one if the serial transmit buffer has room
+};
+
+extern TraceBuffer Trace;
+
+#define TRACE(level, id, a, b)                                   \
+    do                                                           \
+    {                                                            \
+        if ((level) <= TRACE_LEVEL)                              \
+        {                                                        \
+            Trace.record((id), (uint16_t)(a), (uint16_t)(b));    \
+        }                                                        \
+    } while (0)
+#else
+#define TRACE(level, id, a, b) \
+    do                         \
+    {                          \
+    } while (0)
+#endif
+
+// Answers a trace request (an empty block when tracing is compiled out)
+void traceDump();
+// Background draining, call once per pass (does nothing unless TRACE_STREAM is defined)
+void traceStream();
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef UART_SERIAL
+#define UART_SERIAL
+
+#include <Arduino.h>
+
+// Receive ring size, sized to hold a whole upload (SERIAL_PACKET bytes) with room to spare (1 - 256, one slot stays empty)
+#ifndef SERIAL_RX_SIZE
+#define SERIAL_RX_SIZE 160
+#endif
+#ifndef SERIAL_TX_SIZE
+#define SERIAL_TX_SIZE 64
+#endif
+
+#ifdef __AVR__
+/**
+ * USART0 driver replacing the core's Serial (which owns the USART interrupts and a 64 byte receive buffer)
+ * Received bytes go into a larger ring from the receive interrupt, so a whole upload can arrive while the main
+ *  loop is busy rendering or writing EEPROM, and losses are counted rather than silent: bytes that found the
+ *  ring full (the loop fell behind), and bytes the UART overwrote before the interrupt could take them
+ *  (interrupts masked for longer than a byte time, e.g. by Adafruit_NeoPixel::show()).
+ * Transmission works as in the core: a ring drained by the data register empty interrupt, writes wait while
+ *  it is full.
+ * An optional hook is run from the receive interrupt for each byte put in the ring, so the main loop can be told
+ *  about serial data instead of polling for it (it must be short and interrupt safe).
+ */
+class UartSerial : public Stream
+{
+private:
+    uint8_t _rx[SERIAL_RX_SIZE];
+    uint8_t _tx[SERIAL_TX_SIZE];
+    // All four indices are shared with the interrupts (as in HardwareSerial), so none is held in a register
+    volatile uint8_t _rxHead;   // Written by the receive interrupt
+    volatile uint8_t _rxTail;   // Read by the receive interrupt for overflow and the high water mark
+    volatile uint8_t _txHead;   // Read by the transmit interrupt to stop when the ring is empty
+    volatile uint8_t _txTail;   // Advanced by the transmit interrupt
+    bool _written;              // Whether anything was sent since begin() (flush() has nothing to wait for otherwise)
+    void (*_received)(uint8_t); // Run for each byte received
+    volatile uint16_t _rxLost;
+    volatile uint16_t _rxLate;
+    volatile uint8_t _rxHighWater;
+
+public:
+    void begin(unsigned long baud, void (*received)(uint8_t) = 0);
+    int available();
+    int peek();
+    int read();
+    int availableForWrite();
+    void flush(); // Waits for the last byte to leave
+    size_t write(uint8_t);
+    using Print::write;
+    operator bool() { return true; }
+
+    uint16_t rxLost();                              // Bytes that found the receive ring full
+    uint16_t rxLate();                              // Bytes overwritten in the UART before the interrupt ran
+    uint8_t rxHighWater() { return _rxHighWater; }  // Most bytes held in the receive ring at once
+    uint8_t rxSize() { return SERIAL_RX_SIZE - 1; } // Bytes the receive ring can hold
+
+    void receive();  // Takes a byte from the UART (called from the receive interrupt)
+    void transmit(); // Feeds the UART (called from the data register empty interrupt, or by hand with interrupts off)
+};
+
+extern UartSerial Uart;
+#else
+// Off AVR the simulation's port stands in, with the same counters (LampSim::serialPace models the buffers)
+typedef SimSerial UartSerial;
+extern SimSerial &Uart;
+#endif
+
+#endif
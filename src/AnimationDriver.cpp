@@ -1,15 +1,93 @@
 #include <AnimationDriver.h>
-// Debug flags
-// #define DEBUG
-// #define DEBUG_TIME
+#include <avr/pgmspace.h>
+#include <string.h>
+#include <Trace.h>
 
-#ifdef DEBUG
-#include <Arduino.h>
-#endif
 namespace AnimationDriver
 {
+    // Easing curves sampled at 32 points of progress (0 - 255 of 256, the curve always ends at 256), indexed from EASE_IN
+    const uint8_t easeTables[][32] PROGMEM = {
+        // EASE_IN
+        {0, 0, 1, 2, 4, 6, 9, 12, 16, 20, 25, 30, 36, 42, 49, 56, 64, 72, 81, 90, 100, 110, 121, 132, 144, 156, 169, 182, 196, 210, 225, 240},
+        // EASE_OUT
+        {0, 16, 31, 46, 60, 74, 87, 100, 112, 124, 135, 146, 156, 166, 175, 184, 192, 200, 207, 214, 220, 226, 231, 236, 240, 244, 247, 250, 252, 254, 255, 255},
+        // EASE_IN_OUT
+        {0, 1, 3, 6, 11, 17, 24, 31, 40, 49, 59, 70, 81, 92, 104, 116, 128, 140, 152, 164, 175, 186, 197, 207, 216, 225, 232, 239, 245, 250, 253, 255},
+        // SINE
+        {0, 1, 2, 6, 10, 15, 22, 29, 37, 47, 57, 68, 79, 91, 103, 115, 128, 141, 153, 165, 177, 188, 199, 209, 219, 227, 234, 241, 246, 250, 254, 255},
+        // CUBIC_IN
+        {0, 0, 0, 0, 0, 1, 2, 3, 4, 6, 8, 10, 14, 17, 21, 26, 32, 38, 46, 54, 62, 72, 83, 95, 108, 122, 137, 154, 172, 191, 211, 233},
+        // CUBIC_OUT
+        {0, 23, 45, 65, 84, 102, 119, 134, 148, 161, 173, 184, 194, 202, 210, 218, 224, 230, 235, 239, 242, 246, 248, 250, 252, 253, 254, 255, 255, 255, 255, 255},
+    };
 
-    AnimationDriver::AnimationDriver(animation initAnim, sysTimeFunc getSysTime)
+    // Scales a value by a fraction (0 - 255 as 0 - 1)
+    static inline uint8_t scale8(uint8_t val, uint8_t scale)
+    {
+        return ((uint16_t)val * (1 + scale)) >> 8;
+    }
+
+    // Integer HSV to RGB, hue in 1/256 steps over the full circle (0 - 65535)
+    void hsvToRgb(uint16_t hue, uint8_t sat, uint8_t val, uint8_t *rgb)
+    {
+        // Six sectors across the circle, and the position within the sector
+        uint32_t h6 = (uint32_t)hue * 6;
+        uint8_t sector = h6 >> 16;
+        uint8_t f = h6 >> 8;
+        uint8_t p = scale8(val, 255 - sat);
+        uint8_t q = scale8(val, 255 - scale8(sat, f));
+        uint8_t t = scale8(val, 255 - scale8(sat, 255 - f));
+        switch (sector)
+        {
+        case 0:
+            rgb[0] = val, rgb[1] = t, rgb[2] = p;
+            break;
+        case 1:
+            rgb[0] = q, rgb[1] = val, rgb[2] = p;
+            break;
+        case 2:
+            rgb[0] = p, rgb[1] = val, rgb[2] = t;
+            break;
+        case 3:
+            rgb[0] = p, rgb[1] = q, rgb[2] = val;
+            break;
+        case 4:
+            rgb[0] = t, rgb[1] = p, rgb[2] = val;
+            break;
+        default:
+            rgb[0] = val, rgb[1] = p, rgb[2] = q;
+            break;
+        }
+    }
+
+    /**
+     * Applies an easing curve to segment progress
+     * @param ease the easing mode
+     * @param progress progress through the segment (0 - 256)
+     * @return eased progress (0 - 256)
+     */
+    uint16_t applyEasing(easing ease, uint16_t progress)
+    {
+        switch (ease)
+        {
+        case LINEAR:
+            return progress;
+        case STEP:
+            return progress < 256 ? 0 : 256;
+        default:
+        {
+            // Linear interpolation between table points
+            const uint8_t *table = easeTables[ease - EASE_IN];
+            uint8_t index = progress >> 3;
+            uint8_t fraction = progress & 7;
+            uint16_t a = index < 32 ? pgm_read_byte(&table[index]) : 256;
+            uint16_t b = index < 31 ? pgm_read_byte(&table[index + 1]) : 256;
+            return a + (((b - a) * fraction) >> 3);
+        }
+        }
+    }
+
+    AnimationDriver::AnimationDriver(const animation &initAnim, sysTimeFunc getSysTime)
     {
         _getSysTime = getSysTime;
         updateAnimation(initAnim);
@@ -20,103 +98,298 @@ namespace AnimationDriver
     }
 
     void AnimationDriver::restart()
+    {
+        AnimationCore::restart(_getSysTime());
+    }
+
+    void AnimationDriver::updateAnimation(const animation &newAnim)
+    {
+        ownAnimation = newAnim;
+        AnimationCore::updateAnimation(ownAnimation, _getSysTime());
+    }
+
+    void AnimationDriver::updateAnimationP(const flashAnimation *newAnim)
+    {
+        AnimationCore::updateAnimationP(newAnim, _getSysTime());
+    }
+
+    /**
+     * Runs the Animation logic based on system time and calls hardware-aware function defined in parent scope
+     * @param drivingFunc the function to drive hardware, arguments passed in are (uint8_t r, uint8_t g, uint8_t b)
+     */
+    void AnimationDriver::run(drivingFunc runLEDs)
+    {
+        const uint8_t *c = update(_getSysTime());
+        if (c)
+        {
+            runLEDs(c[0], c[1], c[2]);
+        }
+    }
+
+    AnimationCore::AnimationCore() : transitionTime(0), fading(false), phaseLock(false), isStatic(false), dirty(true)
+    {
+        color[0] = color[1] = color[2] = 0;
+    }
+
+    // Sets how long (ms) to crossfade from the last output color into a new or restarted animation (0 cuts)
+    void AnimationCore::setTransition(uint16_t time)
+    {
+        transitionTime = time;
+    }
+
+    // Aligns animation starts to multiples of their period, so lamps on a shared clock play in phase
+    void AnimationCore::setPhaseLock(bool lock)
+    {
+        phaseLock = lock;
+    }
+
+    void AnimationCore::restart(unsigned long now)
     {
         frameIndex = 0;
-        lastStartTime = _getSysTime();
+        lastStartTime = phaseLock && period ? now - now % period : now;
         currentTime = 0;
+        loadFrames();
+        // Fade in from whatever was shown last
+        fromColor[0] = color[0];
+        fromColor[1] = color[1];
+        fromColor[2] = color[2];
+        transitionStart = now;
+        fading = transitionTime > 0;
+        dirty = true;
+    }
+
+    // Copies a frame of the active animation into SRAM
+    void AnimationCore::loadFrame(uint8_t index, animFrame &frame)
+    {
+        if (inFlash)
+        {
+            memcpy_P(&frame, &activeFrames[index], sizeof(animFrame));
+        }
+        else
+        {
+            frame = activeFrames[index];
+        }
     }
 
-    // Updates private timing variables
-    void AnimationDriver::updateTime()
+    // Whether every frame of the current animation has the same color (the output never changes)
+    bool AnimationCore::scanStatic()
+    {
+        animFrame first, frame;
+        loadFrame(0, first);
+        for (uint8_t i = 1; i < frameCount; i++)
+        {
+            loadFrame(i, frame);
+            if (memcmp(first.color, frame.color, 3))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Loads the pair of frames the current time is between
+    void AnimationCore::loadFrames()
+    {
+        loadFrame(frameIndex, lastFrame);
+        loadFrame(frameIndex + 1, nextFrame);
+        // Split the easing out of the frame times
+        ease = (easing)(lastFrame.time >> EASE_SHIFT);
+        lastFrame.time &= FRAME_TIME_MASK;
+        nextFrame.time &= FRAME_TIME_MASK;
+        // Divide once per segment rather than on every render, for segments up to 65.5 s
+        segmentLength = nextFrame.time - lastFrame.time;
+        segmentShift = segmentLength > 0xFFFFFFUL ? 8 : 0; // Keeps elapsed << 8 within 32 bits
+        segmentLength >>= segmentShift;
+        segmentScale = segmentLength && segmentLength <= 0xFFFF ? 0x1000000UL / segmentLength : 0;
+    }
+
+    // Updates private timing variables (inline: most renders stay between the same two frames)
+    inline void AnimationCore::updateTime(unsigned long now)
     {
         // Set current time since last animation start
-        currentTime = _getSysTime() - lastStartTime;
-#ifdef DEBUG_TIME
-        Serial.print("LastStart: ");
-        Serial.print(lastStartTime);
-        Serial.print(" Current: ");
-        Serial.print(currentTime);
-        Serial.println();
-        Serial.flush();
-#endif
-        // If the current time has reached the next frame time
-        if (currentTime > activeAnimation.frames[frameIndex + 1].time)
+        currentTime = now - lastStartTime;
+        if (currentTime > nextFrame.time || (period && currentTime > period))
+        {
+            advanceFrames();
+        }
+    }
+
+    // Moves to the frames the current time is between
+    void AnimationCore::advanceFrames()
+    {
+        // Skip whole periods missed since the last render
+        if (period && currentTime > period)
+        {
+            unsigned long skipped = currentTime - currentTime % period;
+            TRACE(TRACE_DEBUG, TR_ANIM_SKIP, skipped / period, period);
+            lastStartTime += skipped;
+            currentTime -= skipped;
+            frameIndex = 0;
+            loadFrames();
+        }
+        // Catch up to the frames the current time is between (several can pass between render ticks)
+        for (uint8_t steps = frameCount; steps && currentTime > nextFrame.time; steps--)
         {
             frameIndex++;
             // Frame index has passed the last frame
-            if (frameIndex == activeAnimation.frameCount-1)
+            if (frameIndex == frameCount - 1)
             {
                 // Move last start time forward by one animation period
-                lastStartTime += activeAnimation.time;
+                lastStartTime += period;
                 // Trim the extra animation period from current time
-                currentTime -= activeAnimation.time;
+                currentTime -= period;
                 // Reset Frame index
                 frameIndex = 0;
             }
+            loadFrames();
+            TRACE(TRACE_DEBUG, TR_ANIM_FRAME, frameIndex, currentTime);
         }
-#ifdef DEBUG_TIME
-        Serial.print("Frame:");
-        Serial.print(frameIndex);
-        Serial.println();
-        Serial.flush();
-#endif
     }
 
     // Interpolates b/w frames and updates current color state
-    void AnimationDriver::interpolateColor()
-    {
-
-        animFrame *last = &activeAnimation.frames[frameIndex];
-        animFrame *next = &activeAnimation.frames[frameIndex + 1];
-
-#ifdef DEBUG_TIME
-        Serial.print("Last- Time: ");
-        Serial.print(last->time);
-        Serial.print(" Color: ");
-        Serial.print(last->color[2]);
-        Serial.print(" Next- Time: ");
-        Serial.print(next->time);
-        Serial.print(" Color: ");
-        Serial.print(next->color[2]);
-        Serial.println();
-        Serial.flush();
-#endif
-        // Linearly interpolate between current and next R,G,B values
+    inline void AnimationCore::interpolateColor()
+    {
+
+        animFrame *last = &lastFrame;
+        animFrame *next = &nextFrame;
+
+        // Progress through the segment (0 - 256), then eased
+        uint32_t elapsed = (currentTime - last->time) >> segmentShift;
+        uint16_t progress = 256;
+        if (elapsed < segmentLength && !segmentScale)
+        {
+            progress = (elapsed << 8) / segmentLength;
+        }
+        else if (elapsed < segmentLength)
+        {
+            progress = (elapsed * segmentScale) >> 16;
+            // The reciprocal is rounded down, so the quotient can come out one short
+            if ((uint32_t)(progress + 1) * segmentLength <= elapsed << 8)
+            {
+                progress++;
+            }
+        }
+        // Linear RGB, the common case, without the calls
+        if (ease != LINEAR)
+        {
+            progress = applyEasing(ease, progress);
+        }
+        if (hsv)
+        {
+            blendColor(last->color, next->color, progress, true, color);
+            return;
+        }
         for (uint8_t i = 0; i < 3; i++)
         {
-            color[i] = (uint8_t)((float)last->color[i] + ((float)next->color[i] - (float)last->color[i]) / ((float)next->time - (float)last->time) * (float)(currentTime - last->time));
+            color[i] = blend(last->color[i], next->color[i], progress);
+        }
+    }
+
+    // Blends two frame colors by progress (0 - 256), in R,G,B or H,S,V, into an RGB color
+    void blendColor(const uint8_t *from, const uint8_t *to, uint16_t progress, bool hsv, uint8_t *rgb)
+    {
+        uint8_t i = 0;
+        uint16_t hue = 0;
+        if (hsv)
+        {
+            // Hue travels forward around the circle, kept at 1/256 step resolution
+            hue = ((uint16_t)from[0] << 8) + (uint16_t)(uint8_t)(to[0] - from[0]) * progress;
+            i = 1;
+        }
+        for (; i < 3; i++)
+        {
+            rgb[i] = blend(from[i], to[i], progress);
+        }
+        if (hsv)
+        {
+            hsvToRgb(hue, rgb[1], rgb[2], rgb);
         }
     }
 
     // Update the current animation and refresh index
-    void AnimationDriver::updateAnimation(animation newAnim)
+    void AnimationCore::updateAnimation(const animation &newAnim, unsigned long now)
+    {
+        activeFrames = newAnim.frames;
+        inFlash = false;
+        frameCount = FRAME_COUNT(newAnim.frameCount);
+        hsv = newAnim.frameCount & HSV_FLAG;
+        period = newAnim.time;
+        isStatic = scanStatic();
+        restart(now);
+    }
+
+    // Play an animation straight from flash (PROGMEM), without copying it to SRAM
+    void AnimationCore::updateAnimationP(const flashAnimation *newAnim, unsigned long now)
     {
-        activeAnimation = newAnim;
-        restart();
+        flashAnimation header;
+        memcpy_P(&header, newAnim, sizeof(header));
+        activeFrames = header.frames;
+        inFlash = true;
+        frameCount = FRAME_COUNT(header.frameCount);
+        hsv = header.frameCount & HSV_FLAG;
+        period = header.time;
+        isStatic = scanStatic();
+        restart(now);
     }
 
     /**
-     * Runs the Animation logic based on system time and calls hardware-aware function defined in parent scope
-     * @param drivingFunc the function to drive hardware, arguments passed in are (uint8_t r, uint8_t g, uint8_t b)
+     * Runs the Animation logic based on system time, skipping it when the output cannot have changed
+     *  (a static animation that has already been shown, with no crossfade running)
+     * @param now current system time
+     * @return the color state (r, g, b) to drive the hardware with, or null if it has not changed since the last call
      */
-    void AnimationDriver::run(drivingFunc runLEDs)
+    const uint8_t *AnimationCore::update(unsigned long now)
+    {
+        if (isStatic && !fading && !dirty)
+        {
+            return 0;
+        }
+        render(now);
+        if (!dirty && !memcmp(color, shown, 3))
+        {
+            return 0;
+        }
+        memcpy(shown, color, 3);
+        dirty = false;
+        return color;
+    }
+
+    // Makes the next update() return the color even if it has not changed
+    void AnimationCore::redraw()
+    {
+        dirty = true;
+    }
+
+    /**
+     * Runs the Animation logic based on system time
+     * @param now current system time
+     * @return the color state (r, g, b) to drive the hardware with
+     */
+    const uint8_t *AnimationCore::render(unsigned long now)
     {
         // Update time-dependant variables
-        updateTime();
+        updateTime(now);
         // Determine color state
         interpolateColor();
-// Pass color state to parent hardware-aware function
-#ifdef DEBUG
-        Serial.print("R: ");
-        Serial.print(color[0]);
-        Serial.print("G: ");
-        Serial.print(color[1]);
-        Serial.print("B: ");
-        Serial.print(color[2]);
-        Serial.println();
-        Serial.flush();
-#endif
-        runLEDs(color[0], color[1], color[2]);
+        // Blend in from the previous animation's last color while transitioning
+        if (fading)
+        {
+            unsigned long elapsed = now - transitionStart;
+            if (elapsed >= transitionTime)
+            {
+                fading = false;
+            }
+            else
+            {
+                uint16_t progress = (elapsed << 8) / transitionTime;
+                for (uint8_t i = 0; i < 3; i++)
+                {
+                    color[i] = blend(fromColor[i], color[i], progress);
+                }
+            }
+        }
+        TRACE(TRACE_DEBUG, TR_ANIM_COLOR, color[0] << 8 | color[1], color[2]);
+        return color;
     }
 
 } // namespace AnimationDriver
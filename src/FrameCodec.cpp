@@ -0,0 +1,47 @@
+#include <FrameCodec.h>
+#include <string.h>
+
+void decodeAnimation(uint8_t frameCount, const uint8_t *frames, AnimationDriver::animation &anim)
+{
+    uint8_t count = FRAME_COUNT(frameCount);
+    anim.frameCount = frameCount;
+    if (frameCount & SCRIPT_FLAG)
+    {
+        // Programs are stored as sent
+        memcpy(anim.frames, frames, count * FRAME_SIZE);
+        anim.time = 0;
+        return;
+    }
+    for (uint8_t i = 0; i < count; i++, frames += FRAME_SIZE)
+    {
+        AnimationDriver::animFrame &frame = anim.frames[i];
+        frame.color[0] = frames[0];
+        frame.color[1] = frames[1];
+        frame.color[2] = frames[2];
+        frame.time = (uint32_t)frames[3] << 24 | (uint32_t)frames[4] << 16 | (uint32_t)frames[5] << 8 | frames[6];
+    }
+    anim.time = count ? anim.frames[count - 1].time & FRAME_TIME_MASK : 0;
+}
+
+uint16_t encodeFrames(const AnimationDriver::animation &anim, uint8_t *frames)
+{
+    uint8_t count = FRAME_COUNT(anim.frameCount);
+    if (anim.frameCount & SCRIPT_FLAG)
+    {
+        // Programs are sent as stored
+        memcpy(frames, anim.frames, count * FRAME_SIZE);
+        return count * FRAME_SIZE;
+    }
+    for (uint8_t i = 0; i < count; i++, frames += FRAME_SIZE)
+    {
+        const AnimationDriver::animFrame &frame = anim.frames[i];
+        frames[0] = frame.color[0];
+        frames[1] = frame.color[1];
+        frames[2] = frame.color[2];
+        frames[3] = (uint8_t)(frame.time >> 24);
+        frames[4] = (uint8_t)(frame.time >> 16);
+        frames[5] = (uint8_t)(frame.time >> 8);
+        frames[6] = (uint8_t)frame.time;
+    }
+    return count * FRAME_SIZE;
+}
@@ -0,0 +1,144 @@
+#include <HapticEngine.h>
+#include <Arduino.h>
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Timer2 fast PWM with TOP = OCR2A: 16 MHz / 64 / 250 = 1 kHz
+#define HAPTIC_TOP 249
+#endif
+
+HapticEngine Haptics;
+
+void HapticEngine::begin(uint8_t pin, void (*done)())
+{
+    _pin = pin;
+    _done = done;
+    _step = 0;
+    _level = 0;
+    pinMode(_pin, OUTPUT);
+    digitalWrite(_pin, LOW);
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        TCCR2A = _BV(WGM21) | _BV(WGM20); // Fast PWM (mode 7, TOP = OCR2A), OC2A/OC2B pins disconnected
+        TCCR2B = _BV(WGM22) | _BV(CS22);  // clk / 64
+        OCR2A = HAPTIC_TOP;
+        TIMSK2 = 0; // Interrupts only while a pattern plays
+    }
+#endif
+}
+
+// Start a pattern stored in PROGMEM
+void HapticEngine::play(const hapticStep *pattern)
+{
+    hapticStep first;
+    memcpy_P(&first, pattern, sizeof(first));
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        _step = pattern;
+        _elapsed = 0;
+        // Start the first step straight away, before the interrupt can tick it (an empty pattern is ended by the
+        //  first tick, so the done callback only ever runs from the interrupt)
+        if (first.time)
+        {
+            _elapsed = 1;
+            output(first.from);
+        }
+#ifdef __AVR__
+        TCNT2 = 0;
+        TIFR2 = _BV(TOV2) | _BV(OCF2B);
+        TIMSK2 = _BV(TOIE2) | _BV(OCIE2B);
+#endif
+    }
+}
+
+void HapticEngine::stop()
+{
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        _step = 0;
+#ifdef __AVR__
+        TIMSK2 = 0;
+#endif
+        output(0);
+    }
+}
+
+bool HapticEngine::isPlaying()
+{
+    return _step != 0;
+}
+
+// Sets the drive level for the next PWM period
+void HapticEngine::output(uint8_t level)
+{
+    _level = level;
+#ifdef __AVR__
+    // 255 stays on for the whole period (compare never matches above TOP)
+    OCR2B = level == 255 ? HAPTIC_TOP + 1 : ((uint16_t)level * (HAPTIC_TOP + 1)) >> 8;
+#endif
+    digitalWrite(_pin, level ? HIGH : LOW);
+}
+
+// Advances the pattern by one ms and starts the next PWM period
+void HapticEngine::tick()
+{
+    const hapticStep *step = _step;
+    if (!step)
+    {
+        return;
+    }
+    hapticStep current;
+    memcpy_P(&current, step, sizeof(current));
+    // Move on to the next step once this one has run its time
+    if (_elapsed >= current.time && current.time)
+    {
+        step++;
+        _elapsed = 0;
+        memcpy_P(&current, step, sizeof(current));
+        _step = step;
+    }
+    if (!current.time)
+    {
+        // End of pattern
+        stop();
+        if (_done)
+        {
+            _done();
+        }
+        return;
+    }
+    // Linear ramp across the step
+    int16_t level = current.from + ((int16_t)current.to - current.from) * _elapsed / current.time;
+    _elapsed++;
+    output(level);
+}
+
+// Ends the on time of the current PWM period
+void HapticEngine::pulse()
+{
+    if (_level != 255)
+    {
+        digitalWrite(_pin, LOW);
+    }
+}
+
+#ifdef __AVR__
+// Interruptible, so the SPI LED feed does not have to wait for it (see SpiStrip.h); the flag is cleared on entry and
+//  the next overflow is 1 ms away, so it cannot nest into itself
+ISR(TIMER2_OVF_vect, ISR_NOBLOCK)
+{
+    Haptics.tick();
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+    Haptics.pulse();
+}
+#endif
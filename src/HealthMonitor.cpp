@@ -0,0 +1,269 @@
+#include <HealthMonitor.h>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Trace.h>
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+// Byte RAM is painted with at startup
+#define HEALTH_PAINT 0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+// Paints RAM from the end of the static data to the top of the stack (nothing is on the stack yet)
+void healthPaint() __attribute__((naked, used, section(".init1")));
+void healthPaint()
+{
+    __asm__ __volatile__(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n" ::"M"(HEALTH_PAINT));
+}
+
+// Reset cause, saved before anything can clear it
+static uint8_t resetFlags __attribute__((section(".noinit")));
+// Set by softReset() just before it jumps to the reset vector
+#define HEALTH_SOFT_RESET 0x5A
+static uint8_t softResetMark __attribute__((section(".noinit")));
+
+void healthResetFlags() __attribute__((naked, used, section(".init3")));
+void healthResetFlags()
+{
+    uint8_t flags = MCUSR;
+#ifdef HEALTH_OPTIBOOT
+    if (!flags && softResetMark != HEALTH_SOFT_RESET)
+    {
+        // Optiboot clears MCUSR and hands its value over in r2 (a jump to the reset vector skips the bootloader and
+        //  leaves whatever the application had in r2, hence the mark)
+        __asm__ __volatile__("mov %0, r2" : "=r"(flags));
+    }
+#endif
+    softResetMark = 0;
+    resetFlags = flags;
+    MCUSR = 0;
+    // The watchdog stays on after a watchdog reset
+    wdt_disable();
+}
+
+static uint8_t *heapEnd()
+{
+    return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+
+// Deepest point the stack has reached: the first byte above the heap that has lost its paint
+static uint8_t *stackLow()
+{
+    uint8_t *p = heapEnd();
+    while (p <= &__stack && *p == HEALTH_PAINT)
+    {
+        p++;
+    }
+    return p;
+}
+
+#define NOINIT __attribute__((section(".noinit")))
+#else
+#define NOINIT
+#endif
+
+// Carried across resets other than power-up (in .noinit RAM, which the C runtime leaves alone)
+#define HEALTH_MAGIC 0x4D48
+struct healthCarried
+{
+    uint16_t magic;
+    uint16_t overruns; // Watchdog timeouts not yet in EEPROM
+    uint16_t freeMin;  // Lowest free RAM of the run
+};
+static healthCarried carried NOINIT;
+
+HealthMonitor Health;
+
+void HealthMonitor::begin(int addr, uint16_t budgetMs, bool reset)
+{
+    _addr = addr;
+    _budget = budgetMs * 1000UL;
+    _passMax = 0;
+    _overruns = 0;
+    _freeMin = 0xFFFF;
+    EEPROM.get(_addr, _log);
+    if (_log.wdtResets == 0xFFFF && _log.wdtOverruns == 0xFFFF)
+    {
+        // Erased
+        _log.wdtResets = 0;
+        _log.wdtOverruns = 0;
+    }
+    uint8_t cause = resetCause();
+    if (carried.magic == HEALTH_MAGIC && !(cause & (HEALTH_RESET_POWER | HEALTH_RESET_BROWNOUT)))
+    {
+        // Fold in what the last run did not get to save
+        if (cause & HEALTH_RESET_WATCHDOG && _log.wdtResets != 0xFFFF)
+        {
+            _log.wdtResets++;
+        }
+        if (carried.freeMin < _log.freeMin)
+        {
+            _log.freeMin = carried.freeMin;
+        }
+        fold();
+    }
+    carried.magic = HEALTH_MAGIC;
+    carried.overruns = 0;
+    carried.freeMin = 0xFFFF;
+    EEPROM.put(_addr, _log);
+    _lastCheck = millis();
+    _lastPet = micros();
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        wdt_reset();
+        // Timed sequence, then 2 s with the interrupt (and the reset after it if enabled)
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = _BV(WDIE) | (reset ? _BV(WDE) : 0) | _BV(WDP2) | _BV(WDP1) | _BV(WDP0);
+    }
+#else
+    (void)reset;
+#endif
+}
+
+// Moves watchdog timeouts from .noinit RAM into the EEPROM copy
+void HealthMonitor::fold()
+{
+    uint16_t overruns;
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        overruns = carried.overruns;
+        carried.overruns = 0;
+    }
+    _log.wdtOverruns = (uint32_t)_log.wdtOverruns + overruns > 0xFFFF ? 0xFFFF : _log.wdtOverruns + overruns;
+}
+
+void HealthMonitor::pet()
+{
+    unsigned long now = micros();
+    unsigned long pass = now - _lastPet;
+    _lastPet = now;
+    if (pass > _passMax)
+    {
+        _passMax = pass;
+    }
+    if (pass > _budget)
+    {
+        if (_overruns != 0xFFFF)
+        {
+            _overruns++;
+        }
+        TRACE(TRACE_ERROR, TR_OVERRUN, pass / 1000, 0);
+    }
+#ifdef __AVR__
+    wdt_reset();
+    // The interrupt disarms itself when the watchdog also resets
+    WDTCSR |= _BV(WDIE);
+#endif
+}
+
+void HealthMonitor::check()
+{
+    if (millis() - _lastCheck < HEALTH_CHECK_MS)
+    {
+        return;
+    }
+    _lastCheck = millis();
+#ifdef __AVR__
+    // The painted gap left between the heap and the deepest point of the stack
+    uint16_t free = stackLow() - heapEnd();
+#else
+    uint16_t free = 0xFFFF;
+#endif
+    if (free < _freeMin)
+    {
+        _freeMin = free;
+        carried.freeMin = free;
+    }
+    bool changed = carried.overruns || _freeMin < _log.freeMin;
+    if (changed)
+    {
+        fold();
+        if (_freeMin < _log.freeMin)
+        {
+            _log.freeMin = _freeMin;
+        }
+        EEPROM.put(_addr, _log);
+    }
+}
+
+void HealthMonitor::watchdog()
+{
+    if (carried.overruns != 0xFFFF)
+    {
+        carried.overruns++;
+    }
+    TRACE(TRACE_ERROR, TR_OVERRUN, (micros() - _lastPet) / 1000, 1);
+}
+
+void HealthMonitor::softReset()
+{
+#ifdef __AVR__
+    cli();
+    softResetMark = HEALTH_SOFT_RESET;
+    ((void (*)())0)();
+#endif
+}
+
+uint8_t HealthMonitor::resetCause()
+{
+#ifdef __AVR__
+    return resetFlags & (HEALTH_RESET_POWER | HEALTH_RESET_EXTERNAL | HEALTH_RESET_BROWNOUT | HEALTH_RESET_WATCHDOG);
+#else
+    return HEALTH_RESET_POWER;
+#endif
+}
+
+uint16_t HealthMonitor::stackUsed()
+{
+#ifdef __AVR__
+    return &__stack - stackLow() + 1;
+#else
+    return 0;
+#endif
+}
+
+uint16_t HealthMonitor::heapUsed()
+{
+#ifdef __AVR__
+    return __brkval ? (uint8_t *)__brkval - &__heap_start : 0;
+#else
+    return 0;
+#endif
+}
+
+uint16_t HealthMonitor::freeNow()
+{
+#ifdef __AVR__
+    return (uint8_t *)SP - heapEnd();
+#else
+    return 0;
+#endif
+}
+
+#ifdef __AVR__
+// Interruptible, so the SPI LED feed does not have to wait for it (see SpiStrip.h)
+ISR(WDT_vect, ISR_NOBLOCK)
+{
+    Health.watchdog();
+}
+#endif
@@ -0,0 +1,303 @@
+#include <ScriptVM.h>
+#include <string.h>
+
+namespace AnimationDriver
+{
+    // Operand bytes following each opcode
+    static const uint8_t operandCount[] = {0, 3, 5, 2, 1, 0, 2, 4, 2, 1, 0, 0};
+
+    /**
+     * Points a keyframe segment is faded through
+     * @param points progress (1 - 256) at the end of each fade, rising, the last one 256
+     * @return number of points
+     */
+    static uint8_t curvePoints(const uint8_t *from, const uint8_t *to, easing ease, bool hsv, uint16_t *points)
+    {
+        uint8_t n = 0;
+        if (ease != LINEAR && ease != STEP)
+        {
+            // Evenly along the easing curve
+            for (uint8_t k = 1; k < SCRIPT_CURVE_PARTS; k++)
+            {
+                points[n++] = k * 256 / SCRIPT_CURVE_PARTS;
+            }
+        }
+        else if (ease == LINEAR && hsv && to[0] != from[0])
+        {
+            // HSV to RGB is linear within each sixth of the hue circle, so fades ending on the sector edges are exact
+            uint16_t diff = (uint8_t)(to[0] - from[0]);
+            uint32_t hue = (uint16_t)from[0] << 8;
+            for (uint32_t sector = hue * 6 / 65536 + 1;; sector++)
+            {
+                uint32_t edge = (sector * 65536 + 5) / 6; // First hue of the sector
+                uint32_t progress = (edge - hue + diff - 1) / diff;
+                if (progress >= 256)
+                {
+                    break;
+                }
+                points[n++] = progress;
+            }
+        }
+        points[n++] = 256;
+        return n;
+    }
+
+    // Time into a segment at a progress (0 - 256), without overflowing for long segments
+    static uint32_t segmentTime(uint32_t duration, uint16_t progress)
+    {
+        return (duration >> 8) * progress + ((duration & 0xFF) * progress >> 8);
+    }
+
+    uint8_t compileKeyframes(const animation &anim, uint8_t *program, uint8_t size)
+    {
+        uint8_t count = FRAME_COUNT(anim.frameCount);
+        bool hsv = anim.frameCount & HSV_FLAG;
+        if ((anim.frameCount & SCRIPT_FLAG) || count < 1 || size < 4)
+        {
+            return 0;
+        }
+        uint8_t n = 0;
+        program[n++] = OP_SET;
+        blendColor(anim.frames[0].color, anim.frames[0].color, 0, hsv, &program[n]);
+        n += 3;
+        for (uint8_t i = 1; i < count; i++)
+        {
+            const animFrame &last = anim.frames[i - 1];
+            const animFrame &next = anim.frames[i];
+            uint32_t duration = (next.time & FRAME_TIME_MASK) - (last.time & FRAME_TIME_MASK);
+            easing ease = (easing)(last.time >> EASE_SHIFT);
+            bool step = ease == STEP;
+            uint16_t points[SCRIPT_CURVE_PARTS > 7 ? SCRIPT_CURVE_PARTS : 7];
+            uint8_t pointCount = curvePoints(last.color, next.color, ease, hsv, points);
+            uint16_t reached = 0;
+            for (uint8_t p = 0; p < pointCount; p++)
+            {
+                uint32_t slice = segmentTime(duration, points[p]) - segmentTime(duration, reached);
+                // Fades longer than a single instruction are split into equal parts
+                uint8_t parts = slice / 0xFFFF + 1;
+                for (uint8_t part = 1; part <= parts; part++)
+                {
+                    uint16_t time = slice * part / parts - slice * (part - 1) / parts;
+                    if (n + (step ? 7 : 6) > size)
+                    {
+                        return 0;
+                    }
+                    if (step)
+                    {
+                        program[n++] = OP_WAIT;
+                        program[n++] = time >> 8;
+                        program[n++] = time;
+                        if (part < parts)
+                        {
+                            continue;
+                        }
+                        program[n++] = OP_SET;
+                        blendColor(next.color, next.color, 0, hsv, &program[n]);
+                        n += 3;
+                    }
+                    else
+                    {
+                        uint16_t progress = reached + (uint32_t)(points[p] - reached) * part / parts;
+                        program[n++] = OP_FADE;
+                        blendColor(last.color, next.color, applyEasing(ease, progress), hsv, &program[n]);
+                        n += 3;
+                        program[n++] = time >> 8;
+                        program[n++] = time;
+                    }
+                }
+                reached = points[p];
+            }
+        }
+        return n;
+    }
+
+    ScriptCore::ScriptCore(uint8_t pixels) : program(0), length(0), pixels(pixels < 1 ? 1 : pixels > 8 ? 8 : pixels), seed(0xACE1), dirty(true)
+    {
+        color[0] = color[1] = color[2] = 0;
+    }
+
+    void ScriptCore::load(const uint8_t *newProgram, uint8_t newLength, unsigned long now)
+    {
+        program = newProgram;
+        length = newLength;
+        restart(now);
+    }
+
+    void ScriptCore::restart(unsigned long now)
+    {
+        pc = 0;
+        depth = 0;
+        waiting = false;
+        opStart = now;
+        mask = 0xFF;
+        seed ^= (uint16_t)now;
+        if (!seed)
+        {
+            seed = 0xACE1;
+        }
+        dirty = true;
+    }
+
+    // 16 bit xorshift
+    uint16_t ScriptCore::random()
+    {
+        seed ^= seed << 7;
+        seed ^= seed >> 9;
+        seed ^= seed << 8;
+        return seed;
+    }
+
+    uint16_t ScriptCore::readTime(uint8_t offset)
+    {
+        return (uint16_t)program[pc + offset] << 8 | program[pc + offset + 1];
+    }
+
+    void ScriptCore::randomHue(uint8_t sat, uint8_t val, uint8_t *rgb)
+    {
+        hsvToRgb(random(), sat, val, rgb);
+    }
+
+    // Starts a wait (or a fade from the current color to "to")
+    void ScriptCore::startTimed(uint16_t time, bool fade)
+    {
+        waiting = true;
+        fading = fade;
+        opTime = time;
+        memcpy(from, color, 3);
+    }
+
+    void ScriptCore::step()
+    {
+        uint8_t op = pc < length ? program[pc] : (uint8_t)OP_END;
+        // Truncated or unknown instructions, and loops nested too deep, end the program
+        if (op > OP_RMASK || pc + 1 + operandCount[op] > length || (op == OP_LOOP && depth == 2))
+        {
+            op = OP_END;
+        }
+        const uint8_t *args = &program[pc + 1];
+        switch (op)
+        {
+        case OP_END:
+            pc = 0;
+            depth = 0;
+            return;
+        case OP_SET:
+            memcpy(color, args, 3);
+            break;
+        case OP_FADE:
+            memcpy(to, args, 3);
+            startTimed(readTime(4), true);
+            break;
+        case OP_WAIT:
+            startTimed(readTime(1), false);
+            break;
+        case OP_LOOP:
+            loopStart[depth] = pc + 2;
+            loopCount[depth] = args[0];
+            depth++;
+            break;
+        case OP_NEXT:
+            if (depth)
+            {
+                uint8_t &count = loopCount[depth - 1];
+                if (count == 0 || --count)
+                {
+                    pc = loopStart[depth - 1];
+                    return;
+                }
+                depth--;
+            }
+            break;
+        case OP_RHUE:
+            randomHue(args[0], args[1], color);
+            break;
+        case OP_RFADE:
+            randomHue(args[0], args[1], to);
+            startTimed(readTime(3), true);
+            break;
+        case OP_RWAIT:
+            startTimed(random() % ((uint32_t)readTime(1) + 1), false);
+            break;
+        case OP_MASK:
+            mask = args[0];
+            break;
+        case OP_ROTATE:
+        {
+            uint8_t all = 0xFF >> (8 - pixels);
+            mask &= all;
+            mask = ((mask << 1) | (mask >> (pixels - 1))) & all;
+            break;
+        }
+        case OP_RMASK:
+            mask = random();
+            break;
+        }
+        pc += 1 + operandCount[op];
+    }
+
+    /**
+     * Runs the program up to a system time
+     * @param now current system time
+     * @return the color state (r, g, b) to drive the hardware with
+     */
+    const uint8_t *ScriptCore::render(unsigned long now)
+    {
+        for (uint8_t steps = 0; steps < SCRIPT_MAX_STEPS; steps++)
+        {
+            if (waiting)
+            {
+                unsigned long elapsed = now - opStart;
+                if (elapsed < opTime)
+                {
+                    if (fading)
+                    {
+                        uint16_t progress = (elapsed << 8) / opTime;
+                        for (uint8_t i = 0; i < 3; i++)
+                        {
+                            color[i] = blend(from[i], to[i], progress);
+                        }
+                    }
+                    break;
+                }
+                // The next instruction starts where this one ended
+                opStart += opTime;
+                waiting = false;
+                if (fading)
+                {
+                    memcpy(color, to, 3);
+                }
+            }
+            step();
+        }
+        return color;
+    }
+
+    /**
+     * Runs the program up to a system time
+     * @param now current system time
+     * @return the color state (r, g, b) to drive the hardware with, or null if it and the mask have not changed since the last call
+     */
+    const uint8_t *ScriptCore::update(unsigned long now)
+    {
+        render(now);
+        if (!dirty && !memcmp(color, shown, 3) && mask == shown[3])
+        {
+            return 0;
+        }
+        memcpy(shown, color, 3);
+        shown[3] = mask;
+        dirty = false;
+        return color;
+    }
+
+    uint8_t ScriptCore::getMask()
+    {
+        return mask;
+    }
+
+    // Makes the next update() return the color even if it has not changed
+    void ScriptCore::redraw()
+    {
+        dirty = true;
+    }
+} // namespace AnimationDriver
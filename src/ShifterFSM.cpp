@@ -1,19 +1,20 @@
 #include <ShifterFSM.h>
+#include <Trace.h>
 
-// Uncomment to activate debug statements
-// #define DEBUG
-
-#ifdef DEBUG
-#include <Arduino.h>
-#endif
+ShifterFSMCore::ShifterFSMCore(unsigned long tSettle)
+{
+    _tSettle = tSettle;
+    currentState = POLLING;
+    activeMode = intentMode = polledMode = NEUTRAL;
+    _timer = 0;
+}
 
-ShifterFSM::ShifterFSM(sysTimeFunc getSysTime, unsigned long tSettle)
+ShifterFSM::ShifterFSM(sysTimeFunc getSysTime, unsigned long tSettle) : ShifterFSMCore(tSettle)
 {
     _getSysTime = getSysTime;
-    _tSettle = tSettle;
 }
 
-ShifterFSM::mode ShifterFSM::init(int val)
+ShifterFSMCore::mode ShifterFSMCore::init(int val)
 {
     // Set the initial state of the
     activeMode = getStickMode(val);
@@ -21,7 +22,7 @@ ShifterFSM::mode ShifterFSM::init(int val)
 }
 
 // Get the mode corresponding to a given read hall effect value
-ShifterFSM::mode ShifterFSM::getStickMode(int val)
+ShifterFSMCore::mode ShifterFSMCore::getStickMode(int val)
 {
     switch (val)
     {
@@ -54,6 +55,17 @@ ShifterFSM::mode ShifterFSM::getStickMode(int val)
 }
 
 ShifterFSM::mode ShifterFSM::run(int val, bool isMoving)
+{
+    return ShifterFSMCore::run(val, isMoving, _getSysTime());
+}
+
+/**
+ * Runs one step of the controller
+ * @param val the stick position (0 - 6 for R - 6, anything else is neutral)
+ * @param isMoving whether the stick is currently moving
+ * @param now current system time
+ */
+ShifterFSMCore::mode ShifterFSMCore::run(int val, bool isMoving, unsigned long now)
 {
     if (isMoving)
     {
@@ -63,45 +75,28 @@ ShifterFSM::mode ShifterFSM::run(int val, bool isMoving)
     switch (currentState)
     {
     case POLLING:
-#ifdef DEBUG
-        Serial.print("-POLLING");
-        Serial.flush();
-
-#endif
         polledMode = getStickMode(val);
         if (polledMode != activeMode)
         {
 
             currentState = ARMED;
             intentMode = polledMode;
-#ifdef DEBUG
-            Serial.print("-ARMING");
-            Serial.print(";Intent: ");
-            Serial.print(intentMode);
-            Serial.flush();
-
-#endif
-            _timer = _getSysTime();
+            TRACE(TRACE_INFO, TR_SHIFT_ARMED, intentMode, 0);
+            _timer = now;
         }
         break;
     case MOVING:
-#ifdef DEBUG
-        Serial.print("-MOVING");
-        Serial.flush();
-#endif
+        TRACE(TRACE_DEBUG, TR_SHIFT_MOVING, activeMode, 0);
         activeMode = NEUTRAL;
         currentState = POLLING;
         break;
     case ARMED:
 
         // Only look again after settle time has passed
-        if ((_getSysTime() - _timer) > _tSettle)
+        if ((now - _timer) > _tSettle)
         {
-#ifdef DEBUG
-            Serial.print("-SETTLED");
-            Serial.flush();
-#endif
             polledMode = getStickMode(val);
+            TRACE(TRACE_DEBUG, TR_SHIFT_SETTLED, polledMode, intentMode);
             // Check against the original change
             if (polledMode == intentMode) // If it matches, change to update
             {
@@ -115,12 +110,8 @@ ShifterFSM::mode ShifterFSM::run(int val, bool isMoving)
         break;
 
     case UPDATE:
-#ifdef DEBUG
-        Serial.println("--UPDATING");
-        Serial.flush();
-
-#endif
         activeMode = intentMode;
+        TRACE(TRACE_INFO, TR_SHIFT_UPDATE, activeMode, 0);
         if (activeMode != NEUTRAL)
         {
             updateFlag = true;
@@ -129,16 +120,10 @@ ShifterFSM::mode ShifterFSM::run(int val, bool isMoving)
         break;
     } // End switch
 
-#ifdef DEBUG
-    Serial.print("Current: ");
-    Serial.println(activeMode);
-    Serial.flush();
-
-#endif
     return activeMode;
 }
 
-bool ShifterFSM::getFlag()
+bool ShifterFSMCore::getFlag()
 {
     if (updateFlag)
     {
@@ -149,4 +134,13 @@ bool ShifterFSM::getFlag()
     {
         return false;
     }
+}
+
+ShifterFSMCore::mode ShifterFSMCore::getIntent()
+{
+    if (currentState == ARMED || currentState == UPDATE)
+    {
+        return intentMode;
+    }
+    return NEUTRAL;
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <SpiStrip.h>
+#include <Arduino.h>
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#endif
+
+// Low time that latches a frame into the LEDs (WS2812B needs over 280 us)
+#define SPI_STRIP_LATCH_US 300
+
+SpiStrip StripSPI;
+
+// SPI byte for two WS2812 bits (high bit first): 1x0 1y0 0 0
+static const uint8_t bitPairs[4] = {0x90, 0x98, 0xD0, 0xD8};
+// SPI byte for two 0 bits, sent for unlit pixels
+#define SPI_STRIP_OFF 0x90
+
+void SpiStrip::begin(uint16_t count)
+{
+    _count = count;
+    _brightness = 255;
+    _front = 0;
+    _busy = false;
+    _pending = false;
+    _end = micros() - SPI_STRIP_LATCH_US;
+#ifdef __AVR__
+    // MOSI low while idle, SS as output to stay SPI master
+    digitalWrite(MOSI, LOW);
+    pinMode(MOSI, OUTPUT);
+    pinMode(SCK, OUTPUT);
+    pinMode(SS, OUTPUT);
+    SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR0); // Master, mode 0, MSB first, clk / 16
+    SPSR = _BV(SPI2X);                       // Doubled: clk / 8 = 2 MHz
+#endif
+}
+
+// Brightness applied when encoding (0 - 255, scaled as Adafruit_NeoPixel does)
+void SpiStrip::setBrightness(uint8_t brightness)
+{
+    _brightness = brightness;
+}
+
+// Encodes a color into the back buffer and sends it as soon as the strip is free
+void SpiStrip::write(uint8_t r, uint8_t g, uint8_t b, uint8_t mask)
+{
+    _masks[_front ^ 1] = mask;
+    uint8_t channels[3] = {g, r, b};
+    uint8_t *out = _buffers[_front ^ 1];
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        uint8_t value = ((uint16_t)channels[c] * (_brightness + 1)) >> 8;
+        for (uint8_t shift = 8; shift;)
+        {
+            shift -= 2;
+            *out++ = bitPairs[(value >> shift) & 3];
+        }
+    }
+    _pending = true;
+    poll();
+}
+
+// Starts the queued frame if the previous one has gone out and latched
+void SpiStrip::poll()
+{
+    if (!_pending || _busy || micros() - _end < SPI_STRIP_LATCH_US)
+    {
+        return;
+    }
+    _front ^= 1;
+    _pending = false;
+    _index = 0;
+    _remaining = _count;
+    _byte = byteAt();
+#ifdef __AVR__
+    _busy = true;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        next();
+        SPCR |= _BV(SPIE);
+    }
+#else
+    _end = micros();
+#endif
+}
+
+bool SpiStrip::isBusy()
+{
+    return _busy;
+}
+
+// Encoded byte at _index of the pixel being sent (unlit pixels are sent as black)
+uint8_t SpiStrip::byteAt()
+{
+    uint8_t pixel = _count - _remaining;
+    return _masks[_front] & (1 << (pixel & 7)) ? _buffers[_front][_index] : SPI_STRIP_OFF;
+}
+
+// Sends the byte worked out in advance and works out the one after it, or ends the frame
+void SpiStrip::next()
+{
+    if (!_remaining)
+    {
+#ifdef __AVR__
+        SPCR &= ~_BV(SPIE);
+#endif
+        _busy = false;
+        _end = micros();
+        return;
+    }
+#ifdef __AVR__
+    // First thing, so the line only idles for the interrupt's entry
+    SPDR = _byte;
+#endif
+    if (++_index == SPI_STRIP_PIXEL_BYTES)
+    {
+        _index = 0;
+        _remaining--;
+    }
+    if (_remaining)
+    {
+        _byte = byteAt();
+    }
+}
+
+#ifdef __AVR__
+ISR(SPI_STC_vect)
+{
+    StripSPI.next();
+}
+#endif
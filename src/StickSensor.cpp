@@ -0,0 +1,64 @@
+#include <StickSensor.h>
+#include <Arduino.h>
+#include <AnimationDriver.h>
+#include <LampConfig.h>
+
+int StickFilter::update(int sample)
+{
+    if (_count > FILTER_BUFF)
+    {
+        _sum = 0;
+        _count = 0;
+    }
+    _sum += sample;
+    _count++;
+    return _sum / _count;
+}
+
+int StickFilter::sample()
+{
+    return analogRead(_pin);
+}
+
+int getStickPos(int stick1, int stick2)
+{
+    // R
+    if (abs(stick1 - GR_1) < STICK_THRES && abs(stick2 - GR_2) < STICK_THRES)
+    {
+        return 0;
+    }
+    // 1
+    else if (abs(stick1 - G1_1) < STICK_THRES && abs(stick2 - G1_2) < STICK_THRES)
+    {
+        return 1;
+    }
+    // 2
+    else if (abs(stick1 - G2_1) < STICK_THRES && abs(stick2 - G2_2) < STICK_THRES)
+    {
+        return 2;
+    }
+    // 3
+    else if (abs(stick1 - G3_1) < STICK_THRES && abs(stick2 - G3_2) < STICK_THRES && stick1 < 90)
+    {
+        return 3;
+    }
+    // 4
+    else if (abs(stick1 - G4_1) < STICK_THRES && abs(stick2 - G4_2) < STICK_THRES)
+    {
+        return 4;
+    }
+    // 5
+    else if (abs(stick1 - G5_1) < STICK_THRES && abs(stick2 - G5_2) < STICK_THRES)
+    {
+        return 5;
+    }
+    // 6
+    else if (abs(stick1 - G6_1) < STICK_THRES && abs(stick2 - G6_2) < STICK_THRES)
+    {
+        return 6;
+    }
+    else
+    {
+        return 7;
+    }
+}
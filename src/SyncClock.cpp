@@ -0,0 +1,129 @@
+#include <SyncClock.h>
+#include <LampConfig.h>
+
+// Largest drift correction (ppm), well beyond any ceramic resonator
+#define SYNC_MAX_DRIFT 5000
+// Span of beacons the drift is measured over (ms): from the first that gives a usable rate, to the one that starts
+//  a new span (keeps the sums within 32 bits)
+#define SYNC_DRIFT_MIN_SPAN 4000UL
+#define SYNC_DRIFT_MAX_SPAN 600000UL
+
+SyncClock LampSync;
+
+SyncClock::SyncClock() : _locked(false), _stepped(false), _localBase(0), _sharedBase(0), _last(0), _drift(0), _error(0), _stepPending(false), _stepOffset(0), _anchorLocal(0), _anchorShared(0) {}
+
+// Shared time at a local time from the last correction and the drift estimate
+unsigned long SyncClock::estimate(unsigned long local)
+{
+    unsigned long elapsed = local - _localBase;
+    // elapsed * drift / 1000000, split so no product leaves 32 bits (even 49 days without a beacon), with the part
+    //  under 1000 s summed in us and rounded once (truncating it would drop most of the correction between beacons)
+    long fine = (long)(elapsed / 1000 % 1000) * _drift + (long)(elapsed % 1000) * _drift / 1000;
+    long correction = (long)(elapsed / 1000000L) * _drift + (fine + (fine < 0 ? -500 : 500)) / 1000;
+    return _sharedBase + elapsed + correction;
+}
+
+unsigned long SyncClock::now(unsigned long local)
+{
+    if (!_locked)
+    {
+        return local;
+    }
+    unsigned long shared = estimate(local);
+    if ((long)(shared - _last) < 0)
+    {
+        // Hold while a slew catches the clock up
+        return _last;
+    }
+    _last = shared;
+    return shared;
+}
+
+void SyncClock::beacon(unsigned long shared, unsigned long local)
+{
+    unsigned long expected = estimate(local);
+    long error = (long)(shared - expected);
+    _error = error;
+    if (!_locked || error > SYNC_STEP_MS || error < -SYNC_STEP_MS)
+    {
+        // First beacon or lost track: jump to the sender's time, once a second beacon asks for the same step
+        long disagreement = (long)(shared - local - _stepOffset);
+        bool confirmed = _stepPending && disagreement <= SYNC_STEP_MS && disagreement >= -SYNC_STEP_MS;
+        _stepPending = !confirmed;
+        _stepOffset = shared - local;
+        if (!confirmed)
+        {
+            return;
+        }
+        _stepped = _locked || shared != local;
+        _locked = true;
+        _localBase = local;
+        _sharedBase = shared;
+        _last = shared;
+        _drift = 0;
+        _anchorLocal = local;
+        _anchorShared = shared;
+        return;
+    }
+    _stepPending = false;
+    // Rate from the raw beacon times since the anchor, so it does not depend on the phase corrections, and the
+    //  millisecond resolution of each beacon is spread over the whole span
+    unsigned long span = local - _anchorLocal;
+    if (span >= SYNC_DRIFT_MIN_SPAN)
+    {
+        long gained = (long)(shared - _anchorShared - span);
+        long drift = gained * 1000L / (long)(span / 1000);
+        _drift = drift > SYNC_MAX_DRIFT ? SYNC_MAX_DRIFT : drift < -SYNC_MAX_DRIFT ? -SYNC_MAX_DRIFT : drift;
+    }
+    if (span >= SYNC_DRIFT_MAX_SPAN)
+    {
+        // Start a new span, keeping the drift measured over this one until the next is long enough
+        _anchorLocal = local;
+        _anchorShared = shared;
+    }
+    // Slew out half the phase error, from the estimate the old rate gave (the new rate only applies from here on)
+    _sharedBase = expected + error / 2;
+    _localBase = local;
+}
+
+bool SyncClock::stepped()
+{
+    bool stepped = _stepped;
+    _stepped = false;
+    return stepped;
+}
+
+// CRC-8 (polynomial 0x07)
+static uint8_t syncCrc(const uint8_t *data, uint8_t length)
+{
+    uint8_t crc = 0;
+    while (length--)
+    {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+void SyncClock::encode(unsigned long shared, uint8_t *beacon)
+{
+    beacon[0] = SYNC_BEACON_START;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        beacon[1 + i] = shared >> (24 - 8 * i);
+    }
+    beacon[5] = syncCrc(&beacon[1], 4);
+}
+
+bool SyncClock::decode(const uint8_t *beacon, unsigned long &shared)
+{
+    if (beacon[0] != SYNC_BEACON_START || beacon[5] != syncCrc(&beacon[1], 4))
+    {
+        return false;
+    }
+    shared = (unsigned long)beacon[1] << 24 | (unsigned long)beacon[2] << 16 | (unsigned long)beacon[3] << 8 | beacon[4];
+    return true;
+}
@@ -0,0 +1,130 @@
+#include <Trace.h>
+#include <Arduino.h>
+#include <UartSerial.h>
+
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+// Block header: 'T', record count, records lost
+static void writeHeader(uint8_t count, uint16_t lost)
+{
+    uint8_t header[4] = {'T', count, (uint8_t)(lost >> 8), (uint8_t)lost};
+    Uart.write(header, sizeof(header));
+}
+
+#if TRACE_LEVEL
+#if TRACE_DEPTH < 1 || TRACE_DEPTH > 255
+#error "TRACE_DEPTH must be 1 - 255"
+#endif
+
+TraceBuffer Trace;
+
+static void writeRecord(const traceRecord &r)
+{
+    uint8_t bytes[TRACE_RECORD_SIZE] = {r.id, (uint8_t)(r.a >> 8), (uint8_t)r.a, (uint8_t)(r.b >> 8), (uint8_t)r.b,
+                                        (uint8_t)(r.time >> 24), (uint8_t)(r.time >> 16), (uint8_t)(r.time >> 8), (uint8_t)r.time};
+    Uart.write(bytes, sizeof(bytes));
+}
+
+void TraceBuffer::record(uint8_t id, uint16_t a, uint16_t b)
+{
+    unsigned long time = micros();
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        traceRecord &r = _records[_head];
+        r.time = time;
+        r.a = a;
+        r.b = b;
+        r.id = id;
+        _head = _head + 1 == TRACE_DEPTH ? 0 : _head + 1;
+        if (_count < TRACE_DEPTH)
+        {
+            _count++;
+        }
+        else if (_lost != 0xFFFF)
+        {
+            // The oldest record was overwritten
+            _lost++;
+        }
+    }
+}
+
+// Takes the oldest record
+bool TraceBuffer::pop(traceRecord &r)
+{
+    bool found = false;
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        if (_count)
+        {
+            uint8_t tail = _head >= _count ? _head - _count : _head + TRACE_DEPTH - _count;
+            r = _records[tail];
+            _count--;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Count of lost records since the last call
+uint16_t TraceBuffer::takeLost()
+{
+    uint16_t lost;
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+    {
+        lost = _lost;
+        _lost = 0;
+    }
+    return lost;
+}
+
+void TraceBuffer::dump()
+{
+    // Records arriving while the block goes out wait for the next one
+    uint8_t count = _count;
+    writeHeader(count, takeLost());
+    traceRecord r;
+    for (uint8_t i = 0; i < count && pop(r); i++)
+    {
+        writeRecord(r);
+    }
+    Uart.flush();
+}
+
+void TraceBuffer::stream()
+{
+    traceRecord r;
+    if (Uart.availableForWrite() >= 4 + TRACE_RECORD_SIZE && pop(r))
+    {
+        writeHeader(1, takeLost());
+        writeRecord(r);
+    }
+}
+
+void traceDump()
+{
+    Trace.dump();
+}
+
+void traceStream()
+{
+#ifdef TRACE_STREAM
+    Trace.stream();
+#endif
+}
+#else
+void traceDump()
+{
+    writeHeader(0, 0);
+    Uart.flush();
+}
+
+void traceStream() {}
+#endif
@@ -0,0 +1,185 @@
+#include <UartSerial.h>
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#if SERIAL_RX_SIZE < 2 || SERIAL_RX_SIZE > 256 || SERIAL_TX_SIZE < 2 || SERIAL_TX_SIZE > 256
+#error "SERIAL_RX_SIZE and SERIAL_TX_SIZE must be 2 - 256"
+#endif
+
+UartSerial Uart;
+
+void UartSerial::begin(unsigned long baud, void (*received)(uint8_t))
+{
+    _received = received;
+    // Double speed, as the core sets it up (115200 baud is 2.1% off at 16 MHz rather than 3.5%)
+    uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+    UCSR0A = _BV(U2X0);
+    UBRR0H = setting >> 8;
+    UBRR0L = setting;
+    _written = false;
+    // 8N1
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+void UartSerial::receive()
+{
+    // Status has to be read before the data register
+    bool late = UCSR0A & _BV(DOR0);
+    uint8_t c = UDR0;
+    if (late && _rxLate != 0xFFFF)
+    {
+        _rxLate++;
+    }
+    uint8_t head = _rxHead;
+    uint8_t tail = _rxTail;
+    uint8_t next = head + 1 == SERIAL_RX_SIZE ? 0 : head + 1;
+    if (next == tail)
+    {
+        if (_rxLost != 0xFFFF)
+        {
+            _rxLost++;
+        }
+        return;
+    }
+    _rx[head] = c;
+    _rxHead = next;
+    uint8_t held = next >= tail ? next - tail : next + SERIAL_RX_SIZE - tail;
+    if (held > _rxHighWater)
+    {
+        _rxHighWater = held;
+    }
+    if (_received)
+    {
+        _received(c);
+    }
+}
+
+uint16_t UartSerial::rxLost()
+{
+    uint16_t lost;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        lost = _rxLost;
+    }
+    return lost;
+}
+
+uint16_t UartSerial::rxLate()
+{
+    uint16_t late;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        late = _rxLate;
+    }
+    return late;
+}
+
+int UartSerial::available()
+{
+    uint8_t head = _rxHead;
+    uint8_t tail = _rxTail;
+    return head >= tail ? head - tail : head + SERIAL_RX_SIZE - tail;
+}
+
+int UartSerial::peek()
+{
+    uint8_t tail = _rxTail;
+    return _rxHead == tail ? -1 : _rx[tail];
+}
+
+int UartSerial::read()
+{
+    uint8_t tail = _rxTail;
+    if (_rxHead == tail)
+    {
+        return -1;
+    }
+    uint8_t c = _rx[tail];
+    // Published after the byte is taken, so the interrupt never writes over it
+    _rxTail = tail + 1 == SERIAL_RX_SIZE ? 0 : tail + 1;
+    return c;
+}
+
+int UartSerial::availableForWrite()
+{
+    uint8_t head = _txHead;
+    uint8_t tail = _txTail;
+    return head >= tail ? SERIAL_TX_SIZE - 1 - head + tail : tail - head - 1;
+}
+
+void UartSerial::transmit()
+{
+    uint8_t tail = _txTail;
+    UDR0 = _tx[tail];
+    tail = tail + 1 == SERIAL_TX_SIZE ? 0 : tail + 1;
+    _txTail = tail;
+    // Clear the transmit complete flag (by writing it), keeping the mode bits
+    UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+    if (_txHead == tail)
+    {
+        UCSR0B &= ~_BV(UDRIE0);
+    }
+}
+
+size_t UartSerial::write(uint8_t c)
+{
+    _written = true;
+    // Idle: straight into the data register, which saves an interrupt per byte on short writes
+    if (_txHead == _txTail && (UCSR0A & _BV(UDRE0)))
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            UDR0 = c;
+            UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+        }
+        return 1;
+    }
+    uint8_t head = _txHead;
+    uint8_t next = head + 1 == SERIAL_TX_SIZE ? 0 : head + 1;
+    while (next == _txTail)
+    {
+        // Full: with interrupts off nothing would drain it, so move bytes out by hand
+        if (bit_is_clear(SREG, SREG_I) && (UCSR0A & _BV(UDRE0)))
+        {
+            transmit();
+        }
+    }
+    _tx[head] = c;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        _txHead = next;
+        UCSR0B |= _BV(UDRIE0);
+    }
+    return 1;
+}
+
+void UartSerial::flush()
+{
+    if (!_written)
+    {
+        return;
+    }
+    while (bit_is_set(UCSR0B, UDRIE0) || bit_is_clear(UCSR0A, TXC0))
+    {
+        if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR0B, UDRIE0) && (UCSR0A & _BV(UDRE0)))
+        {
+            transmit();
+        }
+    }
+}
+
+ISR(USART_RX_vect)
+{
+    Uart.receive();
+}
+
+ISR(USART_UDRE_vect)
+{
+    Uart.transmit();
+}
+#else
+SimSerial &Uart = Serial;
+#endif
@@ -13,230 +13,392 @@
 #include <Arduino.h>
 
 #include <EEPROM.h>
+#include <stddef.h>
+#include <avr/sleep.h>
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
 #include <Adafruit_NeoPixel.h>
 #include <ShifterFSM.h>
 #include <MotorFSM.h>
+#include <HapticEngine.h>
+#include <FrameClock.h>
+#include <EventQueue.h>
+#include <SpiStrip.h>
 #include <AnimationDriver.h>
+#include <ScriptVM.h>
+#include <SyncClock.h>
+#include <Trace.h>
+#include <HealthMonitor.h>
+#include <StickSensor.h>
+#include <FrameCodec.h>
+#include <UartSerial.h>
 #include <DefaultAnimations.h>
+#include <LampConfig.h>
 
-// DEBUG FLAGS
-// #define DEBUG
+// DEBUG FLAGS (timing and state are traced instead, see Trace.h)
 // #define DEBUG_MOVING
-// #define DEBUG_STICKS
-// #define DEBUG_MODE
 // #define DEBUG_LED
 // #define DEBUG_STICK_TUNE
-// #define DEBUG_EEPROM
 // #define DEBUG_EEPROM_SERIAL
 
 // Routine enable flags
 #define EN_MOTOR
 #define EN_ANIMATION
+#define EN_SLEEP // Idle the CPU between timer ticks
+// #define EN_SPI_LEDS // Drive the strip from the SPI port (data wired to D11/MOSI instead of PIXEL_PIN) without masking interrupts
+// #define EN_WATCHDOG_RESET // Reset on a stuck loop (needs optiboot, e.g. env nanoatmega328new: the old bootloader never comes back)
 
-// Hardware defs
-#define POT_PIN A6
-#define STICK_PIN_1 A7
-#define STICK_PIN_2 A5
-#define MOTOR_PIN 4
-#define PIXEL_PIN A2
-
-#define NUM_LEDS 4
-
-// Numerical Constants
-// #define T_LOOP 0     // Execution loop time
-#define T_MOTOR 200  // Time motor will be on for after a stick shift
-#define T_SETTLE 150 // Settle time for stick position change
-#define POT_THRES 10 // Threshold to read new pot values
-#define MOVE_THRES 40
-#define MOVE_GAIN 3
-#define T_MOVE_LOOP 30
-#define FILTER_BUFF 20
-#define GEAR_COUNT 6
 // Serial Constants
 #define SERIAL_PACKET 142
-#define FRAME_SIZE 7
+#if SERIAL_RX_SIZE <= SERIAL_PACKET
+#error "SERIAL_RX_SIZE must hold a whole upload (SERIAL_PACKET bytes, plus the empty slot)"
+#endif
 #define META_SIZE 2
 
 // unsigned long loopTimer;
 
-MotorFSM MotorControl([]() { digitalWrite(MOTOR_PIN, HIGH); }, []() { digitalWrite(MOTOR_PIN, LOW); }, []() { pinMode(MOTOR_PIN, OUTPUT); }, millis, T_MOTOR);
-ShifterFSM StickControl(millis, T_SETTLE);
+// Hardware policies for the state machines (resolved at compile time so the calls can be inlined)
+struct SysClock
+{
+  static unsigned long now() { return millis(); }
+};
+// Animation timebase, disciplined to the sync master's beacons when there is one
+struct LampClock
+{
+  static unsigned long now() { return LampSync.now(millis()); }
+};
+
+// Events between modules: interrupt handlers post theirs (serial data, the end of a haptic pattern), loop() posts
+//  the changes it sees on the inputs it polls (the stick and the knob, which have no interrupt), and loop() handles
+//  them all, so a pass with nothing to do costs the input reads and little else
+enum lampEventType : uint8_t
+{
+  EVT_GEAR,       // The stick settled (arg: gear, may be the one it left)
+  EVT_MOTOR_DONE, // The haptic pattern is over, the stick sensors can be trusted again
+  EVT_POT,        // The brightness knob moved (arg: brightness)
+  EVT_SERIAL,     // Serial data came in (a request code or a sync beacon starts)
+};
+struct lampEvent
+{
+  uint8_t type;
+  uint8_t arg;
+};
+// Posted from several contexts, so posts are made with interrupts masked (see EventQueue.h), taken by loop() only
+EventQueueT<lampEvent, 8> lampEvents;
+
+// Posts an event (from an interrupt handler or from loop())
+void postEvent(uint8_t type, uint8_t arg)
+{
+  bool posted;
+#ifdef __AVR__
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+  {
+    posted = lampEvents.push(lampEvent{type, arg});
+  }
+  if (!posted)
+  {
+    TRACE(TRACE_ERROR, TR_EVENT_LOST, type, arg);
+  }
+}
+
+// Haptic pattern played to its end (timer interrupt)
+void onHapticDone()
+{
+  postEvent(EVT_MOTOR_DONE, 0);
+}
+
+// Whether an EVT_SERIAL is waiting to be handled (only one is posted for the bytes that come in until then)
+volatile bool serialPosted = false;
+
+// Local time the first sync beacon start byte waiting in the receive ring came in, while beaconStamped is set
+//  (taken in the interrupt, so a beacon's time does not depend on when loop() gets round to it)
+volatile bool beaconStamped = false;
+unsigned long beaconMillis;
+
+// A byte reached the receive ring (receive interrupt)
+void onSerialReceived(uint8_t c)
+{
+  if (c == SYNC_BEACON_START && !beaconStamped)
+  {
+    beaconMillis = millis();
+    beaconStamped = true;
+  }
+  if (!serialPosted)
+  {
+    serialPosted = true;
+    postEvent(EVT_SERIAL, 0);
+  }
+}
+
+// Haptic patterns ({from level, to level, ms}, ending with a 0 ms step), kept under T_MOTOR
+const hapticStep Haptic_Tick[] PROGMEM = {{255, 255, 30}, {0, 0, 0}};
+const hapticStep Haptic_DoubleTick[] PROGMEM = {{255, 255, 25}, {0, 0, 50}, {255, 255, 25}, {0, 0, 0}};
+const hapticStep Haptic_TripleTick[] PROGMEM = {{255, 255, 20}, {0, 0, 40}, {255, 255, 20}, {0, 0, 40}, {255, 255, 20}, {0, 0, 0}};
+const hapticStep Haptic_RampUp[] PROGMEM = {{60, 255, 150}, {255, 255, 30}, {0, 0, 0}};
+const hapticStep Haptic_RampDown[] PROGMEM = {{255, 255, 30}, {255, 60, 150}, {0, 0, 0}};
+const hapticStep Haptic_Buzz[] PROGMEM = {{160, 160, 180}, {0, 0, 0}};
+
+// Signature played when settling into each gear (R, 1 - 6, neutral)
+const hapticStep *const gearSignatures[] PROGMEM = {Haptic_Buzz, Haptic_Tick, Haptic_DoubleTick, Haptic_TripleTick,
+                                                    Haptic_RampUp, Haptic_RampDown, Haptic_DoubleTick, Haptic_Tick};
+
+// Stick readings are held while the motor shakes the lamp
+bool sticksHeld = false;
+
+// Plays the selected pattern on the motor pin from the timer interrupt; the FSM's runtime caps it
+struct MotorHaptics : SysClock
+{
+  static const hapticStep *pattern; // Pattern played on the next trigger
+  static void setup() { Haptics.begin(MOTOR_PIN, onHapticDone); }
+  static void on()
+  {
+    Haptics.play(pattern);
+    sticksHeld = true;
+  }
+  static void off()
+  {
+    // Cut short by the FSM, so the pattern will not report it is done
+    if (Haptics.isPlaying())
+    {
+      Haptics.stop();
+      sticksHeld = false;
+    }
+  }
+};
+const hapticStep *MotorHaptics::pattern = Haptic_Tick;
+
+MotorFSMT<MotorHaptics> MotorControl(T_MOTOR);
+// Posts the gear the stick settles into
+struct StickEvents : SysClock
+{
+  static void settled(ShifterFSM::mode gear) { postEvent(EVT_GEAR, gear); }
+};
+ShifterFSMT<StickEvents> StickControl(T_SETTLE);
 ShifterFSM::mode currentMode;
+StickFilter stickFilter1(STICK_PIN_1);
+StickFilter stickFilter2(STICK_PIN_2);
 
 Adafruit_NeoPixel strip(NUM_LEDS, PIXEL_PIN, NEO_GRB + NEO_KHZ800);
 
-AnimationDriver::AnimationDriver animator(millis);
+AnimationDriver::AnimationDriverT<LampClock> animator;
+// Gear the animation was loaded for
+ShifterFSM::mode playingMode = ShifterFSM::NEUTRAL;
+// Runs slots holding a program (SCRIPT_FLAG) instead of the animator
+AnimationDriver::ScriptDriverT<LampClock> script(NUM_LEDS);
+bool scriptActive = false;
+FrameClockT<SysClock> frameClock(RENDER_FPS);
+// Render in this pass even if no tick is due (a new animation was swapped in)
+bool renderNow = false;
+
+// Sync role (SYNC_MASTER_ROLE sends beacons) and the time the last beacon went out
+bool syncMaster;
+unsigned long lastBeacon;
 // Default animations
 
-const AnimationDriver::animation Solid_White PROGMEM = SOLID_COLOR(255, 255, 255);
-const AnimationDriver::animation Solid_Red PROGMEM = SOLID_COLOR(255, 0, 0);
-const AnimationDriver::animation Breathe_White PROGMEM = BREATHE_COLOR(255, 255, 255, 3000UL);
-const AnimationDriver::animation Solid_Green PROGMEM = SOLID_COLOR(0, 255, 0);
-const AnimationDriver::animation Rainbow PROGMEM = RAINBOW(4000UL);
-const AnimationDriver::animation Solid_Blue PROGMEM = SOLID_COLOR(0, 0, 255);
+GENERATED_ANIMATION(Solid_White, AnimationDriver::SolidColor<255, 255, 255>);
+GENERATED_ANIMATION(Solid_Red, AnimationDriver::SolidColor<255, 0, 0>);
+GENERATED_ANIMATION(Breathe_White, AnimationDriver::Breathe<255, 255, 255, 3000UL, 2, AnimationDriver::SINE>);
+GENERATED_ANIMATION(Solid_Green, AnimationDriver::SolidColor<0, 255, 0>);
+GENERATED_ANIMATION(Rainbow, AnimationDriver::HueSweep<4000UL>);
+GENERATED_ANIMATION(Solid_Blue, AnimationDriver::SolidColor<0, 0, 255>);
+
+GENERATED_ANIMATION(Solid_Off, AnimationDriver::SolidColor<0, 0, 0>);
 
-const AnimationDriver::animation defaults[] PROGMEM = {
-    Solid_White,
-    Solid_Red,
-    Breathe_White,
-    Solid_Green,
-    Rainbow,
-    Solid_Blue};
+const AnimationDriver::flashAnimation *const defaults[] PROGMEM = {
+    &Solid_White,
+    &Solid_Red,
+    &Breathe_White,
+    &Solid_Green,
+    &Rainbow,
+    &Solid_Blue};
 
-AnimationDriver::animation currentAnim;
+// Double buffer for user animations (built-in animations are played from flash)
+//  The front buffer is playing, the back buffer is prefetched with the gear the stick is settling into
+#define NO_SLOT 0xFF
+AnimationDriver::animation animBuffers[2];
+uint8_t frontBuffer = 0;
+uint8_t frontSlot = NO_SLOT; // User slot held in each buffer
+uint8_t backSlot = NO_SLOT;
 
 // Current and previous values for LED brightness (used to only change brightness when needed)
 uint16_t LEDscale;
 uint16_t prevLEDScale;
 
-// Function used for resetting programmatically
-void (*resetFunc)(void) = 0;
+// Duty cycle accounting, since the last diagnostics report
+unsigned long dutyStart;
+unsigned long sleptMicros;
+unsigned long ledPushes;
 
-// Load specific animation from eeprom into currentAnim
-void EEPROM_Load(uint8_t index)
+// LED output backend (the whole strip shows one color)
+void ledsBegin()
 {
-#ifdef DEBUG_EERPROM
-  Serial.print("Getting Index: ");
-  Serial.print(index);
-  Serial.print(" Addr: ");
-  Serial.println((int)(index * sizeof(currentAnim)));
+#ifdef EN_SPI_LEDS
+  StripSPI.begin(NUM_LEDS);
+#else
+  strip.begin();
+  strip.show();
 #endif
-  EEPROM.get((int)(index * sizeof(AnimationDriver::animation)), currentAnim);
-#ifdef DEBUG_EEPROM
-  Serial.println(currentAnim.frameCount);
-  Serial.println("Animation Loaded");
-  Serial.flush();
+}
+
+void ledsBrightness(uint8_t brightness)
+{
+#ifdef EN_SPI_LEDS
+  StripSPI.setBrightness(brightness);
+#else
+  strip.setBrightness(brightness);
 #endif
 }
 
-// Write defaults to eeprom
-void EEPROM_WriteDefaults()
+void ledsShow(uint8_t r, uint8_t g, uint8_t b)
 {
-#ifdef DEBUG_EEPROM
-  Serial.println("RESETTING ANIMATIONS");
-  Serial.flush();
+#ifdef EN_SPI_LEDS
+  StripSPI.write(r, g, b);
+#else
+  strip.fill(strip.Color(r, g, b));
+  strip.show();
 #endif
-  // Write to defaults to eeprom
-  for (uint8_t i = 0; i < GEAR_COUNT; i++)
+  ledPushes++;
+}
+
+// Shows a color on the pixels in a mask (bit per pixel), the rest off
+void ledsShowMask(uint8_t r, uint8_t g, uint8_t b, uint8_t mask)
+{
+#ifdef EN_SPI_LEDS
+  StripSPI.write(r, g, b, mask);
+#else
+  uint32_t color = strip.Color(r, g, b);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
   {
-    AnimationDriver::animation animBuff;
-    memcpy_P(&animBuff, &defaults[i], sizeof(animBuff));
-#ifdef DEBUG_EEPROM
-    Serial.print("Writing To: ");
-    Serial.println((int)(i * sizeof(animBuff)));
-#endif
-    EEPROM.put((int)(i * sizeof(AnimationDriver::animation)), animBuff);
+    strip.setPixelColor(i, mask & (1 << (i & 7)) ? color : 0);
   }
-  Serial.println("DEFAULTS WRITTEN TO EEPROM");
-  Serial.flush();
+  strip.show();
+#endif
+  ledPushes++;
 }
 
-int getStickPos(int *stick1, int *stick2)
+// Restarts the lamp from the reset vector, marked so the health report shows a software reset
+void restartLamp()
 {
+  Health.softReset();
+}
 
-#define STICK_THRES 30
-// R
-#define GR_1 64
-#define GR_2 10
-// 1
-#define G1_1 271
-#define G1_2 25
-// 2
-#define G2_1 114
-#define G2_2 10
-// 3
-#define G3_1 78
-#define G3_2 98
-// 4
-#define G4_1 99
-#define G4_2 110
-// 5
-#define G5_1 26
-#define G5_2 402
-// 6
-#define G6_1 18
-#define G6_2 126
+// Function used for resetting programmatically
+void (*resetFunc)(void) = restartLamp;
 
-  // R
-  if (abs(*stick1 - GR_1) < STICK_THRES && abs(*stick2 - GR_2) < STICK_THRES)
-  {
-    return 0;
-  }
-  // 1
-  else if (abs(*stick1 - G1_1) < STICK_THRES && abs(*stick2 - G1_2) < STICK_THRES)
-  {
-    return 1;
-  }
-  // 2
-  else if (abs(*stick1 - G2_1) < STICK_THRES && abs(*stick2 - G2_2) < STICK_THRES)
-  {
-    return 2;
+// Header of the built-in animation a BUILTIN_SLOT entry refers to
+#define BUILTIN(slot) ((const AnimationDriver::flashAnimation *)pgm_read_ptr(&defaults[(slot) & ~BUILTIN_SLOT]))
+#define BUILTIN_COUNT (sizeof(defaults) / sizeof(defaults[0]))
 
-  } // 3
-  else if (abs(*stick1 - G3_1) < STICK_THRES && abs(*stick2 - G3_2) < STICK_THRES && *stick1 < 90)
-  {
-    return 3;
+// Whether a user slot holds an animation or program that fits its frames area (an erased slot reads 63 frames)
+bool EEPROM_SlotHolds(uint8_t slot)
+{
+  uint8_t count = FRAME_COUNT(EEPROM.read(slot * sizeof(AnimationDriver::animation) + offsetof(AnimationDriver::animation, frameCount)));
+  return count >= 1 && count <= sizeof(AnimationDriver::animation::frames) / sizeof(AnimationDriver::animFrame);
+}
 
-  } // 4
-  else if (abs(*stick1 - G4_1) < STICK_THRES && abs(*stick2 - G4_2) < STICK_THRES)
-  {
-    return 4;
+// Whether a gear map entry names a user slot or a built-in animation
+bool validSlot(uint8_t slot)
+{
+  return slot & BUILTIN_SLOT ? (slot & ~BUILTIN_SLOT) < BUILTIN_COUNT : slot < GEAR_COUNT;
+}
 
-  } // 5
-  else if (abs(*stick1 - G5_1) < STICK_THRES && abs(*stick2 - G5_2) < STICK_THRES)
+// Get the slot a gear plays: a user slot in EEPROM, or BUILTIN_SLOT | index into defaults[]
+uint8_t EEPROM_GearSlot(uint8_t gear)
+{
+  uint8_t slot = EEPROM.read(GEAR_MAP_ADDR + gear);
+  if (slot == 0xFF)
   {
-    return 5;
+    // Unmapped (erased, e.g. lamps updated from firmware without a gear map): play the gear's own slot, as that
+    //  firmware did
+    slot = gear;
   }
-  // 6
-  else if (abs(*stick1 - G6_1) < STICK_THRES && abs(*stick2 - G6_2) < STICK_THRES)
+  // Invalid entries, and user slots that are erased or hold garbage, fall back to the gear's built-in animation
+  if (!validSlot(slot) || (!(slot & BUILTIN_SLOT) && !EEPROM_SlotHolds(slot)))
   {
-    return 6;
+    slot = BUILTIN_SLOT | gear;
+  }
+  return slot;
+}
+
+// Copy the animation a gear plays into a buffer
+void EEPROM_Get(uint8_t gear, AnimationDriver::animation &anim)
+{
+  uint8_t slot = EEPROM_GearSlot(gear);
+  if (slot & BUILTIN_SLOT)
+  {
+    AnimationDriver::flashAnimation builtin;
+    memcpy_P(&builtin, BUILTIN(slot), sizeof(builtin));
+    memcpy_P(anim.frames, builtin.frames, FRAME_COUNT(builtin.frameCount) * sizeof(AnimationDriver::animFrame));
+    anim.frameCount = builtin.frameCount;
+    anim.time = builtin.time;
   }
   else
   {
-    return 7;
+    EEPROM.get((int)(slot * sizeof(AnimationDriver::animation)), anim);
   }
 }
 
-int readStick1(bool override)
+// Load the animation a gear plays into the back buffer ahead of a shift
+void EEPROM_Prefetch(uint8_t index)
 {
-  static unsigned long sum = 0;
-  static unsigned long count = 0;
-  if (!override)
+  uint8_t slot = EEPROM_GearSlot(index);
+  if ((slot & BUILTIN_SLOT) || slot == frontSlot || slot == backSlot)
   {
-    if (count > FILTER_BUFF)
-    {
-      sum = 0;
-      count = 0;
-    }
-
-    sum += analogRead(STICK_PIN_1);
-    count++;
+    // Nothing to load
+    return;
   }
-
-  return sum / count;
+  EEPROM.get((int)(slot * sizeof(AnimationDriver::animation)), animBuffers[!frontBuffer]);
+  backSlot = slot;
 }
-int readStick2(bool override)
+
+// Start the animation a gear is mapped to (built-ins play straight from flash, user slots swap in from the back buffer)
+void EEPROM_Load(uint8_t index)
 {
-  static unsigned long sum = 0;
-  static unsigned long count = 0;
-  if (!override)
+  uint8_t slot = EEPROM_GearSlot(index);
+  TRACE(TRACE_INFO, TR_LOAD, index, slot);
+  scriptActive = false;
+  if (slot & BUILTIN_SLOT)
+  {
+    animator.updateAnimationP(BUILTIN(slot));
+  }
+  else
   {
-    if (count > FILTER_BUFF)
+    if (slot != frontSlot)
     {
-      sum = 0;
-      count = 0;
+      // Load now if the prefetch missed, then swap buffers
+      if (slot != backSlot)
+      {
+        EEPROM.get((int)(slot * sizeof(AnimationDriver::animation)), animBuffers[!frontBuffer]);
+      }
+      frontBuffer = !frontBuffer;
+      backSlot = frontSlot;
+      frontSlot = slot;
+    }
+    AnimationDriver::animation &anim = animBuffers[frontBuffer];
+    if (anim.frameCount & SCRIPT_FLAG)
+    {
+      // The frames area holds a program
+      script.load((const uint8_t *)anim.frames, FRAME_COUNT(anim.frameCount) * SCRIPT_BLOCK_SIZE);
+      scriptActive = true;
+    }
+    else
+    {
+      animator.updateAnimation(anim);
     }
-    sum += analogRead(STICK_PIN_2);
-    count++;
   }
-
-  return sum / count;
 }
 
-int getStickPos(int stick1, int stick2)
+// Map every gear back to its built-in animation (user slots are left intact)
+void EEPROM_WriteDefaults()
 {
-  return getStickPos(&stick1, &stick2);
+  for (uint8_t i = 0; i < GEAR_COUNT; i++)
+  {
+    EEPROM.update(GEAR_MAP_ADDR + i, BUILTIN_SLOT | i);
+  }
+  Uart.println("DEFAULTS WRITTEN TO EEPROM");
+  Uart.flush();
 }
 
 bool isMoving(int *stick1, int *stick2)
@@ -265,21 +427,31 @@ bool isMoving(int *stick1, int *stick2)
   return output;
 }
 
-void updateAnimator(ShifterFSM::mode *mode)
+// Play a gear's animation (settling back into the gear that is playing carries on)
+void updateAnimator(ShifterFSM::mode mode)
 {
-  static ShifterFSM::mode lastMode;
-  if (lastMode != *mode)
+  if (playingMode != mode)
   {
-    if (*mode == ShifterFSM::R)
+    if (mode == ShifterFSM::R)
+    {
+      scriptActive = false;
+      animator.updateAnimationP(&Solid_Off);
+    }
+    else if (mode > 0 && mode < 7)
     {
-      currentAnim = SOLID_COLOR(0, 0, 0);
+      EEPROM_Load(mode - 1);
     }
-    else if (*mode > 0 && *mode < 7)
+    else if (scriptActive)
     {
-      EEPROM_Load(*mode - 1);
+      script.restart();
     }
-    animator.updateAnimation(currentAnim);
-    lastMode = *mode;
+    else
+    {
+      animator.restart();
+    }
+    playingMode = mode;
+    // Show the first frame in this pass rather than on the next render tick
+    renderNow = true;
   }
 }
 
@@ -289,21 +461,25 @@ void updateAnimator(ShifterFSM::mode *mode)
 void saveAnimationFromSerial(byte *buff)
 {
   AnimationDriver::animation _a;
-  _a.frameCount = buff[1];
-  // For each frame
-  for (byte i = 0; i < buff[1]; i++)
-  {
-    byte baseIndex = i * FRAME_SIZE + 2;
-    _a.frames[i].color[0] = buff[baseIndex];                                                                                                                            // Red
-    _a.frames[i].color[1] = buff[baseIndex + 1];                                                                                                                        // Green
-    _a.frames[i].color[2] = buff[baseIndex + 2];                                                                                                                        // Blue
-    _a.frames[i].time = (uint32_t)buff[baseIndex + 3] << 24 | (uint32_t)buff[baseIndex + 4] << 16 | (uint32_t)buff[baseIndex + 5] << 8 | (uint32_t)buff[baseIndex + 6]; //time
-    if (i == buff[1] - 1)
+  decodeAnimation(buff[1], &buff[2], _a);
+  EEPROM.put(buff[0] * sizeof(AnimationDriver::animation), _a);
+  // The gear now plays its user slot
+  EEPROM.update(GEAR_MAP_ADDR + buff[0], buff[0]);
+}
+
+// Waits for a number of bytes from the pc, returns false if they are not all in before the timeout
+bool waitForBytes(uint8_t count, uint32_t timeout)
+{
+  uint32_t timer = millis();
+  while (Uart.available() < count)
+  {
+    Health.pet();
+    if (millis() - timer > timeout)
     {
-      _a.time = _a.frames[i].time;
+      return false;
     }
   }
-  EEPROM.put(buff[0] * sizeof(AnimationDriver::animation), _a);
+  return true;
 }
 
 // Waits for acknowledge byte (0xff) from pc
@@ -311,13 +487,14 @@ bool waitForAck(uint32_t timeout)
 {
   // Start timer
   uint32_t timer = millis();
-  //  Serial.println(F("Waiting for ACK"));
+  //  Uart.println(F("Waiting for ACK"));
   while (true)
   {
+    Health.pet();
     // Check for Serial data or
-    if (Serial.available() > 0)
+    if (Uart.available() > 0)
     {
-      uint8_t ack = (byte)Serial.read();
+      uint8_t ack = (byte)Uart.read();
       if (ack == 0xff)
       {
         // Success
@@ -326,16 +503,18 @@ bool waitForAck(uint32_t timeout)
       else
       {
         // fail
-        Serial.println(F("ACK Fail"));
-        Serial.flush();
+        TRACE(TRACE_ERROR, TR_ACK_FAIL, ack, 0);
+        Uart.println(F("ACK Fail"));
+        Uart.flush();
         return false;
       }
     }
     // Check if timer has ran out
     else if (millis() - timer > timeout)
     {
-      Serial.println(F("ACK Fail"));
-      Serial.flush();
+      TRACE(TRACE_ERROR, TR_ACK_FAIL, 0xFFFF, 0);
+      Uart.println(F("ACK Fail"));
+      Uart.flush();
       return false;
     }
   }
@@ -345,35 +524,29 @@ bool waitForAck(uint32_t timeout)
 void handleUploadRequest()
 {
   byte localBuff[SERIAL_PACKET];
-  byte buffCount = META_SIZE;
-  // Wait for first 2 bytes to come in
-  while (Serial.available() < META_SIZE)
-    ;
-  Serial.readBytes(localBuff, META_SIZE);
-
-  // While the pc is sending data, store it in the buffer
-  // Loop untill all bytes expected are read
-  while (buffCount < (localBuff[1] * FRAME_SIZE + META_SIZE))
-  {
-    // Let a byte come in
-    while (Serial.available() < 1)
-      ;
-    if (buffCount <= SERIAL_PACKET)
-    {
-      // Append to buffer
-      byte data = (byte)Serial.read();
-      localBuff[buffCount] = data;
-      buffCount++;
-    }
-    // Writing outside buffer space, send an error back
-    else
-    {
-      Serial.println();
-      return;
-    }
+  // Wait for first 2 bytes to come in, a host that stalls gets the lamp reset
+  if (!waitForBytes(META_SIZE, 1000))
+  {
+    resetFunc();
+    return;
+  }
+  Uart.readBytes(localBuff, META_SIZE);
+  uint16_t buffCount = FRAME_COUNT(localBuff[1]) * FRAME_SIZE + META_SIZE;
+  // Larger than the buffer space, send an error back
+  if (buffCount > SERIAL_PACKET)
+  {
+    Uart.println();
+    return;
   }
+  // The receive ring holds a whole packet, so the frames are taken in one go once they are all in
+  if (!waitForBytes(buffCount - META_SIZE, 1000))
+  {
+    resetFunc();
+    return;
+  }
+  Uart.readBytes(localBuff + META_SIZE, buffCount - META_SIZE);
   // Once all the data has been received, write it back to the pc
-  Serial.write(localBuff, buffCount);
+  Uart.write(localBuff, buffCount);
   // Read a check character (0x00 -> fail, 0xff -> success)
   if (waitForAck(1000))
   {
@@ -381,8 +554,8 @@ void handleUploadRequest()
     // Store data in memory if check character came back okay
     saveAnimationFromSerial(localBuff);
     // Send one more string back to indicate write finished
-    Serial.println(F("Done"));
-    Serial.flush();
+    Uart.println(F("Done"));
+    Uart.flush();
   }
   else
   {
@@ -396,15 +569,15 @@ void handleDownloadRequest()
   for (uint8_t i = 0; i < 6; i++)
   {
     AnimationDriver::animation _a;
-    EEPROM.get(i * sizeof(AnimationDriver::animation), _a);
+    EEPROM_Get(i, _a);
     // Write the frame count
     if (!waitForAck(1000))
     {
       resetFunc();
     }
-    Serial.write(i);
-    Serial.write(_a.frameCount);
-    Serial.flush();
+    Uart.write(i);
+    Uart.write(_a.frameCount);
+    Uart.flush();
     // Wait for an acknowledge or timeout
     if (!waitForAck(1000))
     {
@@ -412,25 +585,11 @@ void handleDownloadRequest()
     }
     // Send rest of animation frames
     // Parse animation object into uint8_t array
-    uint8_t frameBuff[_a.frameCount * FRAME_SIZE];
-    for (uint8_t frame = 0; frame < _a.frameCount; frame++)
-    {
-      uint8_t baseIndex = frame * FRAME_SIZE;
-      // Red
-      frameBuff[baseIndex] = _a.frames[frame].color[0];
-      // Green
-      frameBuff[baseIndex + 1] = _a.frames[frame].color[1];
-      // Blue
-      frameBuff[baseIndex + 2] = _a.frames[frame].color[2];
-      // Timestamp (four bytes)
-      frameBuff[baseIndex + 3] = (uint8_t)(_a.frames[frame].time >> 24);
-      frameBuff[baseIndex + 4] = (uint8_t)(_a.frames[frame].time >> 16);
-      frameBuff[baseIndex + 5] = (uint8_t)(_a.frames[frame].time >> 8);
-      frameBuff[baseIndex + 6] = (uint8_t)(_a.frames[frame].time);
-    }
+    uint8_t frameBuff[FRAME_COUNT(_a.frameCount) * FRAME_SIZE];
+    uint16_t frameBytes = encodeFrames(_a, frameBuff);
     // Send buffer
-    Serial.write(frameBuff, _a.frameCount * FRAME_SIZE);
-    Serial.flush();
+    Uart.write(frameBuff, frameBytes);
+    Uart.flush();
     // Wait for acknowledge or timeout
     if (!waitForAck(1000))
     {
@@ -439,15 +598,201 @@ void handleDownloadRequest()
   }
 }
 
-// Handle overall Serial Communication
-void handleSerial()
+// Handle a gear map request: one slot per gear (user slot index, or BUILTIN_SLOT | index of a built-in animation)
+void handleMapRequest()
 {
+  byte gearMap[GEAR_COUNT];
+  // Wait for the whole map to come in
+  if (!waitForBytes(GEAR_COUNT, 1000))
+  {
+    resetFunc();
+    return;
+  }
+  Uart.readBytes(gearMap, GEAR_COUNT);
+  // Store nothing unless every entry is valid
+  for (uint8_t i = 0; i < GEAR_COUNT; i++)
+  {
+    if (!validSlot(gearMap[i]))
+    {
+      Uart.println(F("Map Fail"));
+      Uart.flush();
+      return;
+    }
+  }
+  for (uint8_t i = 0; i < GEAR_COUNT; i++)
+  {
+    EEPROM.update(GEAR_MAP_ADDR + i, gearMap[i]);
+  }
+  Uart.println(F("Done"));
+  Uart.flush();
+}
+
+// Sleeps until the next interrupt (the millis() tick at the latest), timers and serial keep running
+//  (ADC noise reduction mode would also stop the millis() timer)
+void idle()
+{
+  unsigned long start = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_mode();
+  sleptMicros += micros() - start;
+}
+
+// Handle a diagnostics request: duty cycle and render counters since the last report
+void handleInfoRequest()
+{
+  unsigned long window = micros() - dutyStart;
+  Uart.print(F("awake%: "));
+  Uart.println(window >= 100 ? 100 - sleptMicros / (window / 100) : 100);
+  Uart.print(F("window_ms: "));
+  Uart.println(window / 1000);
+  Uart.print(F("fps: "));
+  Uart.println(frameClock.fps());
+  Uart.print(F("frames: "));
+  Uart.println(frameClock.frames());
+  Uart.print(F("dropped: "));
+  Uart.println(frameClock.dropped());
+  Uart.print(F("shows: "));
+  Uart.println(ledPushes);
+  Uart.print(F("sync: "));
+  Uart.println(syncMaster ? F("master") : LampSync.isLocked() ? F("locked") : F("free"));
+  Uart.print(F("sync_drift_ppm: "));
+  Uart.println(LampSync.drift());
+  Uart.print(F("sync_error_ms: "));
+  Uart.println(LampSync.lastError());
+  Uart.flush();
+  dutyStart = micros();
+  sleptMicros = 0;
+  ledPushes = 0;
+  frameClock.start();
+}
+
+// Handle a health request: reset cause, RAM use and loop overruns (this run, and across resets from EEPROM), serial losses
+void handleHealthRequest()
+{
+  uint8_t cause = Health.resetCause();
+  const HealthMonitor::record &log = Health.log();
+  Uart.print(F("reset: "));
+  Uart.println(cause & HEALTH_RESET_WATCHDOG   ? F("watchdog")
+                 : cause & HEALTH_RESET_BROWNOUT ? F("brownout")
+                 : cause & HEALTH_RESET_EXTERNAL ? F("external")
+                 : cause & HEALTH_RESET_POWER    ? F("power")
+                                                 : F("software"));
+  Uart.print(F("stack_used: "));
+  Uart.println(Health.stackUsed());
+  Uart.print(F("heap_used: "));
+  Uart.println(Health.heapUsed());
+  Uart.print(F("free_now: "));
+  Uart.println(Health.freeNow());
+  Uart.print(F("free_min: "));
+  Uart.println(Health.freeMin());
+  Uart.print(F("free_min_ever: "));
+  Uart.println(log.freeMin);
+  Uart.print(F("loop_max_us: "));
+  Uart.println(Health.passMax());
+  Uart.print(F("loop_overruns: "));
+  Uart.println(Health.overruns());
+  Uart.print(F("wdt_overruns: "));
+  Uart.println(log.wdtOverruns);
+  Uart.print(F("wdt_resets: "));
+  Uart.println(log.wdtResets);
+  Uart.print(F("rx_size: "));
+  Uart.println(Uart.rxSize());
+  Uart.print(F("rx_high_water: "));
+  Uart.println(Uart.rxHighWater());
+  Uart.print(F("rx_lost: "));
+  Uart.println(Uart.rxLost());
+  Uart.print(F("rx_late: "));
+  Uart.println(Uart.rxLate());
+  Uart.flush();
+}
+
+// Sends a sync beacon with the lamp's animation time
+void sendSyncBeacon()
+{
+  uint8_t beacon[SYNC_BEACON_SIZE];
+  SyncClock::encode(LampSync.now(millis()), beacon);
+  Uart.write(beacon, sizeof(beacon));
+  Uart.flush();
+}
+
+// Handle a sync beacon (never echoed: the line may be shared with other lamps)
+void handleSyncBeacon()
+{
+  unsigned long local = millis();
+  // The rest of the beacon follows straight on
+  bool whole = waitForBytes(SYNC_BEACON_SIZE, SYNC_BEACON_WAIT_MS);
+  // Received when the interrupt saw the start byte (the stamp is released only once the whole beacon is in, so
+  //  its own bytes cannot set it again)
+  if (beaconStamped)
+  {
+    local = beaconMillis;
+    beaconStamped = false;
+  }
+  if (!whole)
+  {
+    // Not a beacon after all, drop the start byte
+    Uart.read();
+    return;
+  }
+  uint8_t beacon[SYNC_BEACON_SIZE];
+  unsigned long shared;
+  Uart.readBytes(beacon, SYNC_BEACON_SIZE);
+  if (!SyncClock::decode(beacon, shared) || syncMaster)
+  {
+    return;
+  }
+  bool wasLocked = LampSync.isLocked();
+  LampSync.beacon(shared, local);
+  if (LampSync.stepped() || (!wasLocked && LampSync.isLocked()))
+  {
+    // Re-align to the new timebase, in phase with the master
+    animator.setPhaseLock(true);
+    animator.restart();
+    script.restart();
+  }
+}
+
+// Handle a sync role request: one byte, SYNC_MASTER_ROLE to send beacons, anything else to follow them
+void handleSyncRoleRequest()
+{
+  if (!waitForBytes(1, 1000))
+  {
+    resetFunc();
+    return;
+  }
+  uint8_t role = Uart.read();
+  EEPROM.update(SYNC_ROLE_ADDR, role);
+  syncMaster = role == SYNC_MASTER_ROLE;
+  animator.setPhaseLock(syncMaster || LampSync.isLocked());
+  lastBeacon = millis();
+  Uart.println(F("Done"));
+  Uart.flush();
+}
+
+// Handle overall Serial Communication, returns whether the lamp needs to restart (stored data changed)
+bool handleSerial()
+{
+  // Beacons start with a byte no request code uses
+  int first = Uart.peek();
+  if (first == SYNC_BEACON_START)
+  {
+    handleSyncBeacon();
+    return false;
+  }
+  // Anything else that cannot start a request code (line noise, late acknowledges, the rest of a beacon the lamp
+  //  started listening to half way) is dropped
+  if (first < 0x20 || first >= 0x7F)
+  {
+    Uart.read();
+    return false;
+  }
   // Read until code ends
-  String code = Serial.readStringUntil('-');
+  String code = Uart.readStringUntil('-');
+  TRACE(TRACE_INFO, TR_SERIAL, code[0], 0);
   // Echo Back a ready string and acknowledge the code received
-  Serial.print(F("ready_"));
-  Serial.println(code);
-  Serial.flush();
+  Uart.print(F("ready_"));
+  Uart.println(code);
+  Uart.flush();
   // Do something useful with the intent code
   switch (code[0])
   {
@@ -462,10 +807,29 @@ void handleSerial()
   case 'd':
     handleDownloadRequest();
     break;
+  case 'm':
+    handleMapRequest();
+    break;
+  case 'r':
+    EEPROM_WriteDefaults();
+    break;
+  case 'i':
+    handleInfoRequest();
+    return false;
+  case 'y':
+    handleSyncRoleRequest();
+    return false;
+  case 't':
+    traceDump();
+    return false;
+  case 'h':
+    handleHealthRequest();
+    return false;
   default:
-    Serial.println();
+    Uart.println();
     break;
   }
+  return true;
 }
 
 // DEBUG Functions
@@ -474,25 +838,25 @@ void EEPROM_Dump_Anim(uint8_t index)
 {
   AnimationDriver::animation _anim;
   EEPROM.get(index * sizeof(AnimationDriver::animation), _anim);
-  Serial.print(F("Animation at Index "));
-  Serial.println(index);
-  Serial.print(F("Frame Count: "));
-  Serial.println(_anim.frameCount);
-  Serial.print(F("Total Time: "));
-  Serial.println(_anim.time);
-  Serial.println(F("Frames: "));
-  for (uint8_t i = 0; i < _anim.frameCount; i++)
-  {
-    Serial.print(F("Frame: "));
-    Serial.println(i);
-    Serial.print(F("R: "));
-    Serial.println(_anim.frames[i].color[0]);
-    Serial.print(F("G: "));
-    Serial.println(_anim.frames[i].color[1]);
-    Serial.print(F("B: "));
-    Serial.println(_anim.frames[i].color[2]);
-    Serial.print(F("Time: "));
-    Serial.println(_anim.frames[i].time);
+  Uart.print(F("Animation at Index "));
+  Uart.println(index);
+  Uart.print(F("Frame Count: "));
+  Uart.println(_anim.frameCount);
+  Uart.print(F("Total Time: "));
+  Uart.println(_anim.time);
+  Uart.println(F("Frames: "));
+  for (uint8_t i = 0; i < FRAME_COUNT(_anim.frameCount); i++)
+  {
+    Uart.print(F("Frame: "));
+    Uart.println(i);
+    Uart.print(F("R: "));
+    Uart.println(_anim.frames[i].color[0]);
+    Uart.print(F("G: "));
+    Uart.println(_anim.frames[i].color[1]);
+    Uart.print(F("B: "));
+    Uart.println(_anim.frames[i].color[2]);
+    Uart.print(F("Time: "));
+    Uart.println(_anim.frames[i].time);
   }
 }
 #endif
@@ -500,20 +864,33 @@ void EEPROM_Dump_Anim(uint8_t index)
 void setup()
 {
   // Start Serial Communication
-  Serial.begin(115200);
-  Serial.println(F("ready"));
+  Uart.begin(115200, onSerialReceived);
+  Uart.println(F("ready"));
   // LED Setup
-  strip.begin();
-  strip.show();
+  ledsBegin();
   // Initial Motor state
   MotorControl.init();
   // Initial Stick state
-  currentMode = StickControl.init(getStickPos(readStick1(MotorControl.isRunning()), readStick2(MotorControl.isRunning())));
+  currentMode = StickControl.init(getStickPos(stickFilter1.read(sticksHeld), stickFilter2.read(sticksHeld)));
   // Initial Brightness
   LEDscale = analogRead(POT_PIN);
-  strip.setBrightness(LEDscale / 4);
+  ledsBrightness(LEDscale / 4);
+  // Sync role
+  syncMaster = EEPROM.read(SYNC_ROLE_ADDR) == SYNC_MASTER_ROLE;
+  lastBeacon = millis();
   // Animation Controller
-  updateAnimator(&currentMode);
+  animator.setTransition(T_FADE);
+  animator.setPhaseLock(syncMaster);
+  updateAnimator(currentMode);
+  frameClock.start();
+  dutyStart = micros();
+  // Watchdog and RAM checks
+#ifdef EN_WATCHDOG_RESET
+  Health.begin(HEALTH_ADDR, LOOP_BUDGET_MS, true);
+#else
+  Health.begin(HEALTH_ADDR, LOOP_BUDGET_MS, false);
+#endif
+  TRACE(TRACE_INFO, TR_BOOT, currentMode, syncMaster);
 // Initialize timers
 // loopTimer = millis();
 #ifdef DEBUG_STICK_TUNE
@@ -523,57 +900,122 @@ void setup()
 #ifdef DEBUG_EEPROM_SERIAL
   for (uint8_t i = 0; i < 6; i++)
   {
-    Serial.println(F("------------------------"));
+    Uart.println(F("------------------------"));
     EEPROM_Dump_Anim(i);
     delay(1000);
   }
-  Serial.println(F("------------------------"));
+  Uart.println(F("------------------------"));
 #endif
 }
 
-void loop()
+// Act on an event taken from lampEvents
+void handleEvent(const lampEvent &event)
 {
-  if (Serial.available() > 0)
+  TRACE(TRACE_INFO, TR_EVENT, event.type, event.arg);
+  switch (event.type)
   {
-    // Handle Serial Request
-    handleSerial();
-    updateAnimator(&currentMode);
-    resetFunc();
-  }
-  else
-  {
-    /************ BRIGHTNESS KNOB ***********/
-    LEDscale = analogRead(POT_PIN) / 4;
-    if (abs(LEDscale - prevLEDScale) > POT_THRES)
+  case EVT_GEAR:
+#ifdef EN_MOTOR
+    MotorHaptics::pattern = (const hapticStep *)pgm_read_ptr(&gearSignatures[event.arg]);
+    MotorControl.trigger();
+#endif
+#ifdef EN_ANIMATION
+    updateAnimator((ShifterFSM::mode)event.arg);
+#endif
+    break;
+  case EVT_MOTOR_DONE:
+    // Left over from a pattern that a new one has replaced since (the new one reports when it is done)
+    if (!Haptics.isPlaying())
+    {
+      sticksHeld = false;
+    }
+    break;
+  case EVT_POT:
+    ledsBrightness(event.arg);
+    animator.redraw();
+    script.redraw();
+    break;
+  case EVT_SERIAL:
+    // Bytes coming in from here on post a new event, the ones already in are all handled now
+    serialPosted = false;
+    while (Uart.available() > 0)
     {
-      strip.setBrightness(LEDscale);
-      prevLEDScale = LEDscale;
+      // Handle Serial Request
+      if (handleSerial())
+      {
+        updateAnimator(currentMode);
+        resetFunc();
+        return;
+      }
     }
+    // A start byte that came in as part of anything else (e.g. upload frames) is not a beacon's
+    beaconStamped = false;
+    break;
+  }
+}
 
-    /************ HANDLING STICK INPUT ***********/
-    int stick1 = readStick1(MotorControl.isRunning());
-    int stick2 = readStick2(MotorControl.isRunning());
+void loop()
+{
+  Health.pet();
 
-    currentMode = StickControl.run(getStickPos(&stick1, &stick2), isMoving(&stick1, &stick2));
+  /************ BRIGHTNESS KNOB ***********/
+  LEDscale = analogRead(POT_PIN) / 4;
+  if (abs(LEDscale - prevLEDScale) > POT_THRES)
+  {
+    prevLEDScale = LEDscale;
+    postEvent(EVT_POT, (uint8_t)LEDscale);
+  }
+
+  /************ HANDLING STICK INPUT ***********/
+  int stick1 = stickFilter1.read(sticksHeld);
+  int stick2 = stickFilter2.read(sticksHeld);
+  TRACE(TRACE_DEBUG, TR_STICKS, stick1, stick2);
+
+  // Posts EVT_GEAR when the stick settles
+  currentMode = StickControl.run(getStickPos(stick1, stick2), isMoving(&stick1, &stick2));
+
+  /************ EVENTS ***********/
+  // Serial data, knob, gear and motor, in the order they happened
+  lampEvent event;
+  while (lampEvents.pop(event))
+  {
+    handleEvent(event);
+  }
+
+  /************ SYNC BEACONS ***********/
+  if (syncMaster && millis() - lastBeacon >= SYNC_PERIOD)
+  {
+    lastBeacon += SYNC_PERIOD;
+    sendSyncBeacon();
+  }
 
-    /************ MOTOR & ANIMATION RESET TRIGGER ***********/
-    if (StickControl.getFlag())
-    {
-#ifdef EN_MOTOR
-      MotorControl.trigger();
-#endif
 #ifdef EN_ANIMATION
-      updateAnimator(&currentMode);
+  /************ PREFETCH NEXT ANIMATION ***********/
+  ShifterFSM::mode intent = StickControl.getIntent();
+  if (intent > ShifterFSM::R && intent < ShifterFSM::NEUTRAL)
+  {
+    EEPROM_Prefetch(intent - 1);
+  }
 #endif
-    }
-    MotorControl.run();
 
-    /************ DRIVING LEDS ***********/
-    // Pass current animation, time stamp, brightness, into animation driving function
+  /************ MOTOR ***********/
+  MotorControl.run();
+
+  /************ DRIVING LEDS ***********/
+  // Pass current animation, time stamp, brightness, into animation driving function (once per render tick)
 #ifdef EN_ANIMATION
-    animator.run([](uint8_t r, uint8_t g, uint8_t b) { strip.fill(strip.Color(r, g, b));strip.show(); });
-#endif
+  if (frameClock.due() || renderNow)
+  {
+    renderNow = false;
+    if (scriptActive)
+      script.run(ledsShowMask);
+    else
+      animator.run(ledsShow);
   }
+#endif
+#ifdef EN_SPI_LEDS
+  StripSPI.poll();
+#endif
 
   /************ DUBUGGING HELP ***********/
 #ifdef DEBUG_STICK_TUNE
@@ -617,8 +1059,6 @@ void loop()
 #endif
 
 #ifdef DEBUG_MOVING
-  Serial.print(isMoving(&stick1, &stick2) ? "MOVING " : "");
-  ShifterFSM::mode currentMode = StickControl.run(getStickPos(&stick1, &stick2), isMoving(&stick1, &stick2));
 #ifndef DEBUG_LED
   if (isMoving(&stick1, &stick2))
   {
@@ -631,20 +1071,16 @@ void loop()
 #endif
 #endif
 
-#ifdef DEBUG_STICKS
-  Serial.print(" 1: ");
-  Serial.print(analogRead(STICK_PIN_1));
-  Serial.print(" 2: ");
-  Serial.print(analogRead(STICK_PIN_2));
-#endif
+  /************ TRACE AND HEALTH ***********/
+  traceStream();
+  Health.check();
 
-#ifdef DEBUG_MODE
-  Serial.print(" mode: ");
-  Serial.print(currentMode);
-#endif
-
-#ifdef DEBUG
-  Serial.println();
-  Serial.flush();
+#ifdef EN_SLEEP
+  /************ IDLE UNTIL THE NEXT TICK ***********/
+  // Anything that came in (serial data included) posted an event
+  if (lampEvents.empty())
+  {
+    idle();
+  }
 #endif
 }
@@ -0,0 +1,242 @@
+/**
+ * VroomLamp/tools/keyframes/KeyframeFit.cpp
+ *
+ * Host tool that fits the fewest keyframes to a densely sampled color curve.
+ *  Reads "t_ms,r,g,b" rows (sorted by time, the curve loops from the last sample back to the first) and picks
+ *  keyframes among the samples so that playback, using the firmware's own integer blend, stays within the
+ *  error bound on every channel at every sample (the fewest frames over the segments that fit). The result is
+ *  then played back through AnimationCore to confirm the error.
+ * If more than 20 frames are needed, the bound is raised to the smallest one that fits (unless --strict).
+ *
+ * Output is the upload payload saveAnimationFromSerial() parses: slot, frame count, then 7 bytes per frame
+ *  (r, g, b, big-endian time), written raw with --out and as hex on stdout.
+ *
+ * Usage: program [--error n] [--slot n] [--out file] [--strict] curve.csv
+ */
+#include <AnimationDriver.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    struct sample
+    {
+        uint32_t t;
+        uint8_t color[3];
+    };
+
+    const uint8_t MAX_FRAMES = 20;
+    const uint8_t FRAME_BYTES = 7;
+
+    bool loadCurve(const char *path, std::vector<sample> &curve)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            return false;
+        }
+        char line[128];
+        while (fgets(line, sizeof(line), f))
+        {
+            unsigned long t;
+            int r, g, b;
+            if (sscanf(line, "%lu,%d,%d,%d", &t, &r, &g, &b) == 4 && (curve.empty() || t > curve.back().t))
+            {
+                sample s = {(uint32_t)t, {(uint8_t)r, (uint8_t)g, (uint8_t)b}};
+                curve.push_back(s);
+            }
+        }
+        fclose(f);
+        if (curve.size() < 2)
+        {
+            return false;
+        }
+        // Frames start at 0
+        uint32_t start = curve.front().t;
+        for (size_t i = 0; i < curve.size(); i++)
+        {
+            curve[i].t -= start;
+        }
+        return true;
+    }
+
+    // Largest channel error between a sample and the firmware's blend of two keyframes at the sample's time
+    int segmentError(const sample &from, const sample &to, const sample &s)
+    {
+        uint32_t elapsed = s.t - from.t;
+        uint32_t duration = to.t - from.t;
+        uint16_t progress = elapsed >= duration ? 256 : (uint16_t)(((uint64_t)elapsed << 8) / duration);
+        int worst = 0;
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            int diff = abs((int)AnimationDriver::blend(from.color[i], to.color[i], progress) - s.color[i]);
+            worst = diff > worst ? diff : worst;
+        }
+        return worst;
+    }
+
+    bool segmentFits(const std::vector<sample> &curve, size_t from, size_t to, int bound)
+    {
+        for (size_t k = from + 1; k < to; k++)
+        {
+            if (segmentError(curve[from], curve[to], curve[k]) > bound)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Indices of the fewest keyframes (always including the first and last sample)
+    //  Shortest path over every segment that stays within bound. Every end is tried, a segment that fails can fit
+    //  again further on (a rounded or curved span), and only ends the path would shorten are checked.
+    std::vector<size_t> fit(const std::vector<sample> &curve, int bound)
+    {
+        size_t n = curve.size();
+        std::vector<size_t> frames(n, (size_t)-1), previous(n, 0);
+        frames[0] = 1;
+        for (size_t from = 0; from + 1 < n; from++)
+        {
+            for (size_t to = from + 1; to < n; to++)
+            {
+                if (frames[from] + 1 < frames[to] && segmentFits(curve, from, to, bound))
+                {
+                    frames[to] = frames[from] + 1;
+                    previous[to] = from;
+                }
+            }
+        }
+        std::vector<size_t> keys;
+        for (size_t k = n - 1; k; k = previous[k])
+        {
+            keys.insert(keys.begin(), k);
+        }
+        keys.insert(keys.begin(), 0);
+        return keys;
+    }
+
+    AnimationDriver::animation build(const std::vector<sample> &curve, const std::vector<size_t> &keys)
+    {
+        AnimationDriver::animation anim = {};
+        anim.frameCount = keys.size();
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            memcpy(anim.frames[i].color, curve[keys[i]].color, 3);
+            anim.frames[i].time = curve[keys[i]].t;
+        }
+        anim.time = curve.back().t;
+        return anim;
+    }
+
+    // Plays the animation through the firmware's driver and returns the largest error at any sample
+    int playbackError(const AnimationDriver::animation &anim, const std::vector<sample> &curve)
+    {
+        AnimationDriver::AnimationCore core;
+        core.updateAnimation(anim, 0);
+        int worst = 0;
+        for (size_t k = 0; k < curve.size(); k++)
+        {
+            const uint8_t *c = core.render(curve[k].t);
+            for (uint8_t i = 0; i < 3; i++)
+            {
+                int diff = abs((int)c[i] - curve[k].color[i]);
+                worst = diff > worst ? diff : worst;
+            }
+        }
+        return worst;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int bound = 2;
+    int slot = 0;
+    bool strict = false;
+    const char *out = 0;
+    const char *csv = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--error") && i + 1 < argc)
+            bound = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--slot") && i + 1 < argc)
+            slot = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            out = argv[++i];
+        else if (!strcmp(argv[i], "--strict"))
+            strict = true;
+        else if (argv[i][0] != '-' && !csv)
+            csv = argv[i];
+        else
+        {
+            csv = 0;
+            break;
+        }
+    }
+    if (!csv || slot < 0 || slot > 5 || bound < 0)
+    {
+        fprintf(stderr, "usage: %s [--error n] [--slot 0-5] [--out file] [--strict] curve.csv\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<sample> curve;
+    if (!loadCurve(csv, curve))
+    {
+        fprintf(stderr, "could not read a curve (2+ rows of t_ms,r,g,b) from %s\n", csv);
+        return 1;
+    }
+    if (curve.back().t > FRAME_TIME_MASK)
+    {
+        fprintf(stderr, "curve is longer than the %lu ms a frame time can hold\n", (unsigned long)FRAME_TIME_MASK);
+        return 1;
+    }
+
+    std::vector<size_t> keys = fit(curve, bound);
+    if (keys.size() > MAX_FRAMES)
+    {
+        if (strict)
+        {
+            fprintf(stderr, "%lu frames needed within error %d (limit %u)\n", (unsigned long)keys.size(), bound, MAX_FRAMES);
+            return 2;
+        }
+        while (keys.size() > MAX_FRAMES)
+        {
+            keys = fit(curve, ++bound);
+        }
+        fprintf(stderr, "error bound raised to %d to fit in %u frames\n", bound, MAX_FRAMES);
+    }
+
+    AnimationDriver::animation anim = build(curve, keys);
+    int error = playbackError(anim, curve);
+    printf("samples: %lu, frames: %u, runtime: %lu ms, error bound: %d, playback error: %d\n",
+           (unsigned long)curve.size(), anim.frameCount, (unsigned long)anim.time, bound, error);
+
+    // Upload payload, as parsed by saveAnimationFromSerial()
+    std::vector<uint8_t> payload;
+    payload.push_back(slot);
+    payload.push_back(anim.frameCount);
+    for (uint8_t i = 0; i < anim.frameCount; i++)
+    {
+        const AnimationDriver::animFrame &frame = anim.frames[i];
+        uint8_t bytes[FRAME_BYTES] = {frame.color[0], frame.color[1], frame.color[2], (uint8_t)(frame.time >> 24),
+                                      (uint8_t)(frame.time >> 16), (uint8_t)(frame.time >> 8), (uint8_t)frame.time};
+        payload.insert(payload.end(), bytes, bytes + FRAME_BYTES);
+    }
+    for (size_t i = 0; i < payload.size(); i++)
+    {
+        printf("%02X%c", payload[i], i % FRAME_BYTES == 1 || i + 1 == payload.size() ? '\n' : ' ');
+    }
+    if (out)
+    {
+        FILE *f = fopen(out, "wb");
+        if (!f || fwrite(payload.data(), 1, payload.size(), f) != payload.size())
+        {
+            fprintf(stderr, "could not write %s\n", out);
+            return 1;
+        }
+        fclose(f);
+    }
+    return error > bound ? 3 : 0;
+}
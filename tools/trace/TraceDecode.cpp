@@ -0,0 +1,211 @@
+/**
+ * VroomLamp/tools/trace/TraceDecode.cpp
+ *
+ * Host decoder for the firmware's binary trace (see include/Trace.h).
+ *  Reads a raw serial capture, picks out the trace blocks (answers to "t-", or the one-record blocks sent
+ *  with TRACE_STREAM, mixed in with any other output) and prints the records as a timeline: time since the
+ *  first record, time since the previous one, and the record decoded.
+ *
+ * Usage: program [--csv] capture.bin   (- reads stdin)
+ *  e.g. printf 't-' > /dev/ttyUSB0; timeout 2 cat /dev/ttyUSB0 > capture.bin; program capture.bin
+ */
+#include <Trace.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    struct record
+    {
+        uint8_t id;
+        uint16_t a;
+        uint16_t b;
+        uint32_t time;
+    };
+
+    const char *const names[TR_COUNT] = {
+        "boot", "shift.moving", "shift.armed", "shift.settled", "shift.update", "motor.on", "motor.off",
+        "anim.frame", "anim.skip", "anim.color", "event", "event.lost", "load", "serial", "ack.fail", "sticks", "overrun"};
+
+    const char *gearName(uint16_t gear)
+    {
+        static const char *const gears[] = {"R", "1", "2", "3", "4", "5", "6", "N"};
+        return gear < 8 ? gears[gear] : "?";
+    }
+
+    const char *eventName(uint16_t type)
+    {
+        static const char *const events[] = {"gear", "motor-done", "pot", "serial"};
+        return type < 4 ? events[type] : "?";
+    }
+
+    // Record arguments in words, per id
+    void describe(const record &r, char *out, size_t size)
+    {
+        switch (r.id)
+        {
+        case TR_BOOT:
+            snprintf(out, size, "gear %s, %s", gearName(r.a), r.b ? "sync master" : "sync follower");
+            break;
+        case TR_SHIFT_MOVING:
+            snprintf(out, size, "left %s", gearName(r.a));
+            break;
+        case TR_SHIFT_ARMED:
+        case TR_SHIFT_UPDATE:
+            snprintf(out, size, "gear %s", gearName(r.a));
+            break;
+        case TR_SHIFT_SETTLED:
+            snprintf(out, size, "read %s, armed on %s%s", gearName(r.a), gearName(r.b), r.a == r.b ? "" : " (rejected)");
+            break;
+        case TR_MOTOR_ON:
+            snprintf(out, size, "up to %u ms", r.a);
+            break;
+        case TR_ANIM_FRAME:
+            snprintf(out, size, "segment %u at %u ms", r.a, r.b);
+            break;
+        case TR_ANIM_SKIP:
+            snprintf(out, size, "%u periods of %u ms", r.a, r.b);
+            break;
+        case TR_ANIM_COLOR:
+            snprintf(out, size, "#%02X%02X%02X", r.a >> 8, r.a & 0xFF, r.b & 0xFF);
+            break;
+        case TR_EVENT:
+        case TR_EVENT_LOST:
+            if (r.a == 0)
+                snprintf(out, size, "%s %s", eventName(r.a), gearName(r.b));
+            else if (r.a == 2)
+                snprintf(out, size, "%s %u", eventName(r.a), r.b);
+            else
+                snprintf(out, size, "%s", eventName(r.a));
+            break;
+        case TR_LOAD:
+            snprintf(out, size, r.b & 0x80 ? "gear %u from built-in %u" : "gear %u from slot %u", r.a + 1, r.b & 0x7F);
+            break;
+        case TR_SERIAL:
+            snprintf(out, size, r.a >= 0x20 && r.a < 0x7F ? "'%c'" : "0x%02X", r.a);
+            break;
+        case TR_ACK_FAIL:
+            snprintf(out, size, r.a == 0xFFFF ? "timed out" : "got 0x%02X", r.a);
+            break;
+        case TR_STICKS:
+            snprintf(out, size, "%u, %u", r.a, r.b);
+            break;
+        case TR_OVERRUN:
+            snprintf(out, size, r.b ? "stuck %u ms, watchdog" : "pass took %u ms", r.a);
+            break;
+        default:
+            out[0] = 0;
+            break;
+        }
+    }
+
+    uint16_t word(const uint8_t *p) { return (uint16_t)p[0] << 8 | p[1]; }
+
+    // Finds the trace blocks in a capture, skipping anything that does not parse as one
+    void parse(const std::vector<uint8_t> &data, std::vector<record> &records, unsigned long &blocks, unsigned long &lost)
+    {
+        size_t i = 0;
+        while (i + 4 <= data.size())
+        {
+            if (data[i] != 'T')
+            {
+                i++;
+                continue;
+            }
+            uint8_t count = data[i + 1];
+            size_t end = i + 4 + (size_t)count * TRACE_RECORD_SIZE;
+            bool valid = end <= data.size();
+            for (size_t k = i + 4; valid && k < end; k += TRACE_RECORD_SIZE)
+            {
+                valid = data[k] < TR_COUNT;
+            }
+            if (!valid)
+            {
+                i++;
+                continue;
+            }
+            blocks++;
+            lost += word(&data[i + 2]);
+            for (size_t k = i + 4; k < end; k += TRACE_RECORD_SIZE)
+            {
+                const uint8_t *p = &data[k];
+                record r = {p[0], word(p + 1), word(p + 3), (uint32_t)word(p + 5) << 16 | word(p + 7)};
+                records.push_back(r);
+            }
+            i = end;
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool csv = false;
+    const char *path = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--csv"))
+            csv = true;
+        else if (!path)
+            path = argv[i];
+        else
+        {
+            path = 0;
+            break;
+        }
+    }
+    if (!path)
+    {
+        fprintf(stderr, "usage: %s [--csv] capture.bin (- for stdin)\n", argv[0]);
+        return 1;
+    }
+    FILE *f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "could not open %s\n", path);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buff[4096];
+    size_t n;
+    while ((n = fread(buff, 1, sizeof(buff), f)) > 0)
+    {
+        data.insert(data.end(), buff, buff + n);
+    }
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    std::vector<record> records;
+    unsigned long blocks = 0, lost = 0;
+    parse(data, records, blocks, lost);
+    if (csv)
+    {
+        printf("time_us,id,name,a,b\n");
+    }
+    else
+    {
+        printf("%lu records in %lu blocks, %lu lost before they were drained\n", (unsigned long)records.size(), blocks, lost);
+        printf("%12s %10s  %-14s %s\n", "ms", "+ms", "record", "detail");
+    }
+
+    // micros() wraps every 71 minutes, so times are taken relative to the first record
+    unsigned long long elapsed = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const record &r = records[i];
+        uint32_t step = i ? r.time - records[i - 1].time : 0;
+        elapsed += step;
+        if (csv)
+        {
+            printf("%llu,%u,%s,%u,%u\n", elapsed, r.id, names[r.id], r.a, r.b);
+            continue;
+        }
+        char detail[64];
+        describe(r, detail, sizeof(detail));
+        printf("%12.3f %+10.3f  %-14s %s\n", elapsed / 1000.0, step / 1000.0, names[r.id], detail);
+    }
+    return 0;
+}